@@ -0,0 +1,40 @@
+QT       = core gui widgets network concurrent testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = drawit-bench
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    benchmarks.cpp \
+    ../chatlog.cpp \
+    ../remoteplayback.cpp \
+    ../drawit.cpp \
+    ../lineraster.cpp \
+    ../metrics.cpp \
+    ../networkengine.cpp \
+    ../polyline.cpp \
+    ../protocol.cpp \
+    ../sessionrecording.cpp \
+    ../spatialindex.cpp \
+    ../strokebatcher.cpp \
+    ../strokestore.cpp \
+    ../tiledcanvas.cpp
+
+HEADERS += \
+    ../chatlog.h \
+    ../remoteplayback.h \
+    ../drawit.h \
+    ../lineraster.h \
+    ../metrics.h \
+    ../networkengine.h \
+    ../polyline.h \
+    ../protocol.h \
+    ../sessionrecording.h \
+    ../spatialindex.h \
+    ../spscqueue.h \
+    ../strokebatcher.h \
+    ../strokestore.h \
+    ../tiledcanvas.h
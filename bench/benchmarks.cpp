@@ -0,0 +1,618 @@
+#include <QtTest>
+#include <QImage>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <QTcpSocket>
+#include <QThread>
+#include <functional>
+#include "drawit.h"
+#include "lineraster.h"
+#include "networkengine.h"
+#include "protocol.h"
+#include "spatialindex.h"
+#include "strokestore.h"
+#include "tiledcanvas.h"
+
+// Benchmarks for the render, wire format and fan-out hot paths. Run with
+// e.g. "drawit-bench -o results.csv,csv" or "-o results.xml,xml" to get
+// output that can be diffed between builds. tileRebuild times every canvas
+// size drawn segment by segment and from cached whole strokes, once with
+// LineRaster and once with QPainter. Frame sizes are reported
+// through the BytesAllocated metric, since QtTest has no plain byte count.
+// lineRasterMatches is a correctness check rather than a benchmark: every
+// SIMD backend must match the scalar one exactly, and the scalar one must
+// stay close to what QPainter draws. layerRebuild compares rebuilding one
+// player's layer, as an undo or clear does, with rebuilding every layer.
+// undoRebuild undoes and redoes one stroke on a canvas that never compacts;
+// only strokes still within reach of undo are redrawn, so it should take
+// the same time for every history size.
+// largeSnapshot is another correctness check: a joiner's snapshot several
+// times the send queue's high-water mark must go out once, without the
+// host mistaking it for congestion and resyncing the peer again.
+// undoAfterCompaction checks that an Undo takes back the same stroke on a
+// canvas that has compacted its history as on one that has not.
+class DrawItBenchmarks : public QObject {
+    Q_OBJECT
+
+private slots:
+    void tileRebuild_data();
+    void tileRebuild();
+    void layerRebuild_data();
+    void layerRebuild();
+    void paintEvent_data();
+    void paintEvent();
+    void undoRebuild_data();
+    void undoRebuild();
+    void lineRaster_data();
+    void lineRaster();
+    void lineRasterMatches_data();
+    void lineRasterMatches();
+    void encode_data();
+    void encode();
+    void decode_data();
+    void decode();
+    void frameSize_data();
+    void frameSize();
+    void fanOut_data();
+    void fanOut();
+    void largeSnapshot();
+    void undoAfterCompaction();
+};
+
+static const QSize CanvasSize(1000, 600);
+static const int PointsPerStroke = 256;
+static const int RasterSegments = 2000;
+static const quint16 BenchPort = Protocol::DefaultPort + 100;
+
+static QVector<QPoint> randomWalk(QRandomGenerator &random, int count) {
+    QVector<QPoint> points;
+    QPoint point(random.bounded(CanvasSize.width()), random.bounded(CanvasSize.height()));
+    for (int i = 0; i < count; ++i) {
+        point += QPoint(random.bounded(-4, 5), random.bounded(-4, 5));
+        point.setX(qBound(0, point.x(), CanvasSize.width() - 1));
+        point.setY(qBound(0, point.y(), CanvasSize.height() - 1));
+        points.append(point);
+    }
+    return points;
+}
+
+static void addPointRows() {
+    QTest::addColumn<int>("points");
+    for (int points : {1000, 10000, 100000, 1000000}) {
+        QTest::newRow(qPrintable(QString::number(points))) << points;
+    }
+}
+
+static void addMessageRows() {
+    QTest::addColumn<QByteArray>("frame");
+    QRandomGenerator random(1);
+    QTest::newRow("chat") << Protocol::encodeChat("Player: is that a cat or a horse?");
+    QTest::newRow("strokeBegin") << Protocol::encodeStrokeBegin(QPoint(500, 300), 5, 0xff336699);
+    for (int count : {1, 16, 256}) {
+        QVector<QPoint> points = randomWalk(random, count + 1);
+        QPoint origin = points.takeFirst();
+        QTest::newRow(qPrintable(QString("strokePoints x%1").arg(count))) << Protocol::encodeStrokePoints(origin, points);
+    }
+}
+
+void DrawItBenchmarks::tileRebuild_data() {
+    QTest::addColumn<int>("points");
+    QTest::addColumn<bool>("cachedPaths");
+    QTest::addColumn<bool>("rasterizer");
+    for (bool rasterizer : {true, false}) {
+        const char *renderer = rasterizer ? "lineraster" : "qpainter";
+        for (int points : {1000, 10000, 100000, 1000000}) {
+            QTest::newRow(qPrintable(QString("%1 segments %2").arg(points).arg(renderer))) << points << false << rasterizer;
+            QTest::newRow(qPrintable(QString("%1 paths %2").arg(points).arg(renderer))) << points << true << rasterizer;
+        }
+    }
+}
+
+// Strokes are dealt to the players in turn.
+static void addStrokes(QRandomGenerator &random, int points, int players, bool cachedPaths, StrokeStore *store, SpatialIndex *index, TiledCanvas *tiles) {
+    for (int remaining = points; remaining > 0; remaining -= PointsPerStroke) {
+        QVector<QPoint> walk = randomWalk(random, qMin(remaining, PointsPerStroke));
+        quint16 owner = quint16(store->strokeCount() % players);
+        int stroke = store->beginStroke(walk[0], 2 + random.bounded(9), QColor::fromRgb(random.generate()), owner);
+        index->insert(*store, stroke, 0);
+        for (int i = 1; i < walk.size(); ++i) {
+            store->appendPoint(stroke, walk[i]);
+            index->insert(*store, stroke, i);
+        }
+        store->endStroke(stroke);
+        if (cachedPaths) {
+            tiles->cacheStrokePath(*store, stroke);
+        }
+    }
+}
+
+void DrawItBenchmarks::tileRebuild() {
+    QFETCH(int, points);
+    QFETCH(bool, cachedPaths);
+    QFETCH(bool, rasterizer);
+    const bool previous = LineRaster::isEnabled();
+    LineRaster::setEnabled(rasterizer);
+    QRandomGenerator random(1);
+    StrokeStore store;
+    SpatialIndex index(CanvasSize);
+    TiledCanvas tiles(CanvasSize);
+    addStrokes(random, points, 1, cachedPaths, &store, &index, &tiles);
+
+    QBENCHMARK {
+        tiles.invalidate(QRect(QPoint(0, 0), CanvasSize), 0);
+        tiles.render(store, index);
+    }
+    LineRaster::setEnabled(previous);
+}
+
+void DrawItBenchmarks::layerRebuild_data() {
+    QTest::addColumn<int>("rebuilt");
+    QTest::newRow("1 of 4 layers") << 1;
+    QTest::newRow("4 of 4 layers") << 4;
+}
+
+void DrawItBenchmarks::layerRebuild() {
+    QFETCH(int, rebuilt);
+    const int players = 4;
+    QRandomGenerator random(1);
+    StrokeStore store;
+    SpatialIndex index(CanvasSize);
+    TiledCanvas tiles(CanvasSize);
+    addStrokes(random, 100000, players, true, &store, &index, &tiles);
+    for (int owner = 0; owner < players; ++owner) {
+        tiles.invalidate(QRect(QPoint(0, 0), CanvasSize), quint16(owner));
+    }
+    tiles.render(store, index);
+
+    QBENCHMARK {
+        for (int owner = 0; owner < rebuilt; ++owner) {
+            tiles.invalidate(QRect(QPoint(0, 0), CanvasSize), quint16(owner));
+        }
+        tiles.render(store, index);
+    }
+}
+
+void DrawItBenchmarks::paintEvent_data() {
+    addPointRows();
+}
+
+void DrawItBenchmarks::paintEvent() {
+    QFETCH(int, points);
+    QRandomGenerator random(1);
+    DrawingArea area;
+    for (int remaining = points; remaining > 0; remaining -= PointsPerStroke) {
+        QVector<QPoint> walk = randomWalk(random, qMin(remaining, PointsPerStroke));
+        int stroke = area.beginStroke(walk[0], 2 + random.bounded(9), QColor::fromRgb(random.generate()));
+        for (int i = 1; i < walk.size(); ++i) {
+            area.extendStroke(stroke, walk[i]);
+        }
+        area.endStroke(stroke);
+    }
+
+    QImage target(area.size(), QImage::Format_ARGB32_Premultiplied);
+    QBENCHMARK {
+        area.render(&target);
+    }
+}
+
+void DrawItBenchmarks::undoRebuild_data() {
+    addPointRows();
+}
+
+void DrawItBenchmarks::undoRebuild() {
+    // DrawingArea's undo depth plus one bake batch.
+    static const int UnbakedStrokes = 64 + 32;
+
+    QFETCH(int, points);
+    QRandomGenerator random(1);
+    DrawingArea area;
+    for (int remaining = points; remaining > 0; remaining -= PointsPerStroke) {
+        QVector<QPoint> walk = randomWalk(random, qMin(remaining, PointsPerStroke));
+        int stroke = area.beginStroke(walk[0], 2 + random.bounded(9), QColor::fromRgb(random.generate()));
+        for (int i = 1; i < walk.size(); ++i) {
+            area.extendStroke(stroke, walk[i]);
+        }
+        area.endStroke(stroke);
+    }
+    auto unbaked = [&area]() {
+        int count = 0;
+        const StrokeStore &store = area.strokeStore();
+        for (int i = 0; i < store.strokeCount(); ++i) {
+            if (!store.stroke(i).baked) ++count;
+        }
+        return count;
+    };
+    QVERIFY(QTest::qWaitFor([&]() { return unbaked() < UnbakedStrokes; }, 60000));
+
+    QImage target(area.size(), QImage::Format_ARGB32_Premultiplied);
+    QBENCHMARK {
+        area.undo();
+        area.render(&target);
+        area.redo();
+        area.render(&target);
+    }
+}
+
+// Raster rows run "qpainter" against every LineRaster backend; backends the
+// CPU lacks are skipped.
+static void addRasterRows() {
+    QTest::addColumn<int>("backend");
+    QTest::addColumn<int>("width");
+    for (int width : {2, 8, 24}) {
+        QTest::newRow(qPrintable(QString("qpainter w%1").arg(width))) << -1 << width;
+        for (LineRaster::Backend backend : {LineRaster::Scalar, LineRaster::Sse2, LineRaster::Avx2}) {
+            QTest::newRow(qPrintable(QString("%1 w%2").arg(LineRaster::backendName(backend)).arg(width))) << int(backend) << width;
+        }
+    }
+}
+
+static QVector<QPoint> rasterWalk() {
+    QRandomGenerator random(1);
+    QVector<QPoint> points;
+    QPoint point(CanvasSize.width() / 2, CanvasSize.height() / 2);
+    for (int i = 0; i <= RasterSegments; ++i) {
+        point += QPoint(random.bounded(-20, 21), random.bounded(-20, 21));
+        point.setX(qBound(0, point.x(), CanvasSize.width() - 1));
+        point.setY(qBound(0, point.y(), CanvasSize.height() - 1));
+        points.append(point);
+    }
+    return points;
+}
+
+static void rasterizeWalk(QImage *image, const QVector<QPoint> &walk, int backend, int width, QRgb color) {
+    if (backend < 0) {
+        QPainter painter(image);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setPen(QPen(QColor::fromRgba(color), width, Qt::SolidLine, Qt::RoundCap));
+        for (int i = 1; i < walk.size(); ++i) {
+            painter.drawLine(walk[i - 1], walk[i]);
+        }
+        return;
+    }
+    LineRaster::setBackend(LineRaster::Backend(backend));
+    for (int i = 1; i < walk.size(); ++i) {
+        LineRaster::drawSegment(image, QPoint(0, 0), walk[i - 1], walk[i], width, color);
+    }
+}
+
+void DrawItBenchmarks::lineRaster_data() {
+    addRasterRows();
+}
+
+void DrawItBenchmarks::lineRaster() {
+    QFETCH(int, backend);
+    QFETCH(int, width);
+    if (backend >= 0 && !LineRaster::isSupported(LineRaster::Backend(backend))) {
+        QSKIP("backend not supported by this CPU");
+    }
+    const LineRaster::Backend previous = LineRaster::backend();
+    const QVector<QPoint> walk = rasterWalk();
+    QImage image(CanvasSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    QBENCHMARK {
+        rasterizeWalk(&image, walk, backend, width, 0xff336699);
+    }
+    LineRaster::setBackend(previous);
+}
+
+void DrawItBenchmarks::lineRasterMatches_data() {
+    QTest::addColumn<int>("width");
+    QTest::addColumn<QRgb>("color");
+    QTest::newRow("opaque w2") << 2 << QRgb(0xff336699);
+    QTest::newRow("opaque w9") << 9 << QRgb(0xffcc3300);
+    QTest::newRow("translucent w24") << 24 << QRgb(0x8000aa44);
+}
+
+void DrawItBenchmarks::lineRasterMatches() {
+    QFETCH(int, width);
+    QFETCH(QRgb, color);
+    const LineRaster::Backend previous = LineRaster::backend();
+    const QVector<QPoint> walk = rasterWalk().mid(0, 200);
+    QImage background(CanvasSize, QImage::Format_ARGB32_Premultiplied);
+    background.fill(QColor(250, 240, 220));
+
+    QImage scalar = background.copy();
+    rasterizeWalk(&scalar, walk, LineRaster::Scalar, width, color);
+    for (LineRaster::Backend backend : {LineRaster::Sse2, LineRaster::Avx2}) {
+        if (!LineRaster::isSupported(backend)) continue;
+        QImage image = background.copy();
+        rasterizeWalk(&image, walk, backend, width, color);
+        QVERIFY2(image == scalar, LineRaster::backendName(backend));
+    }
+    LineRaster::setBackend(previous);
+
+    // QPainter's antialiasing differs in the last few levels along edges,
+    // so compare the covered pixels statistically rather than exactly.
+    QImage reference = background.copy();
+    rasterizeWalk(&reference, walk, -1, width, color);
+    qint64 covered = 0;
+    qint64 totalDifference = 0;
+    qint64 farOff = 0;
+    for (int y = 0; y < CanvasSize.height(); ++y) {
+        const QRgb *expected = reinterpret_cast<const QRgb *>(reference.constScanLine(y));
+        const QRgb *actual = reinterpret_cast<const QRgb *>(scalar.constScanLine(y));
+        const QRgb *plain = reinterpret_cast<const QRgb *>(background.constScanLine(y));
+        for (int x = 0; x < CanvasSize.width(); ++x) {
+            if (expected[x] == plain[x] && actual[x] == plain[x]) continue;
+            int difference = qMax(qMax(qAbs(qRed(expected[x]) - qRed(actual[x])), qAbs(qGreen(expected[x]) - qGreen(actual[x]))),
+                                  qMax(qAbs(qBlue(expected[x]) - qBlue(actual[x])), qAbs(qAlpha(expected[x]) - qAlpha(actual[x]))));
+            ++covered;
+            totalDifference += difference;
+            if (difference > 64) ++farOff;
+        }
+    }
+    QVERIFY(covered > 0);
+    QVERIFY2(totalDifference < covered * 8, qPrintable(QString("mean difference %1").arg(double(totalDifference) / covered)));
+    QVERIFY2(farOff * 100 < covered, qPrintable(QString("%1 of %2 pixels differ by more than 64").arg(farOff).arg(covered)));
+}
+
+void DrawItBenchmarks::encode_data() {
+    addMessageRows();
+}
+
+void DrawItBenchmarks::encode() {
+    QFETCH(QByteArray, frame);
+    Protocol::Frame decoded;
+    FrameReader reader;
+    reader.append(frame);
+    QVERIFY(reader.readFrame(&decoded));
+
+    QString message;
+    Protocol::StrokeStart start;
+    QVector<QPoint> points;
+    QPoint origin(500, 300);
+    if (decoded.opcode == Protocol::Chat) {
+        QVERIFY(Protocol::decodeChat(decoded.payload, &message));
+        QBENCHMARK {
+            Protocol::encodeChat(message);
+        }
+    } else if (decoded.opcode == Protocol::StrokeBegin) {
+        QVERIFY(Protocol::decodeStrokeBegin(decoded.payload, &start));
+        QBENCHMARK {
+            Protocol::encodeStrokeBegin(start.point, start.brushSize, start.color);
+        }
+    } else {
+        QVERIFY(Protocol::decodeStrokePoints(decoded.payload, origin, &points));
+        QBENCHMARK {
+            Protocol::encodeStrokePoints(origin, points);
+        }
+    }
+}
+
+void DrawItBenchmarks::decode_data() {
+    addMessageRows();
+}
+
+void DrawItBenchmarks::decode() {
+    QFETCH(QByteArray, frame);
+    QBENCHMARK {
+        FrameReader reader;
+        reader.append(frame);
+        Protocol::Frame decoded;
+        while (reader.readFrame(&decoded)) {
+            QString message;
+            Protocol::StrokeStart start;
+            QVector<QPoint> points;
+            if (decoded.opcode == Protocol::Chat) {
+                Protocol::decodeChat(decoded.payload, &message);
+            } else if (decoded.opcode == Protocol::StrokeBegin) {
+                Protocol::decodeStrokeBegin(decoded.payload, &start);
+            } else {
+                Protocol::decodeStrokePoints(decoded.payload, QPoint(), &points);
+            }
+        }
+    }
+}
+
+void DrawItBenchmarks::frameSize_data() {
+    addMessageRows();
+}
+
+void DrawItBenchmarks::frameSize() {
+    QFETCH(QByteArray, frame);
+    QTest::setBenchmarkResult(frame.size(), QTest::BytesAllocated);
+}
+
+// A host engine listening on BenchPort from its own thread, and clients that
+// open with Hello and pass every frame they read to a callback. Clients,
+// engine and thread are all torn down with it.
+class BenchHost {
+public:
+    explicit BenchHost(int maxPlayers) : engine(new NetworkEngine()) {
+        engine->moveToThread(&thread);
+        QObject::connect(&thread, &QThread::finished, engine, &QObject::deleteLater);
+        thread.start();
+        engine->setMaxPlayers(maxPlayers);
+        QMetaObject::invokeMethod(engine, [this]() { engine->startServer(BenchPort); }, Qt::BlockingQueuedConnection);
+    }
+
+    ~BenchHost() {
+        qDeleteAll(clients);
+        QMetaObject::invokeMethod(engine, &NetworkEngine::shutdown, Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
+    }
+
+    QTcpSocket *addClient(const std::function<void(const Protocol::Frame &)> &onFrame) {
+        QTcpSocket *socket = new QTcpSocket();
+        QObject::connect(socket, &QTcpSocket::connected, socket, [socket]() { socket->write(Protocol::encodeHello()); });
+        QObject::connect(socket, &QTcpSocket::readyRead, socket, [socket, onFrame, reader = FrameReader()]() mutable {
+            reader.append(socket->readAll());
+            Protocol::Frame frame;
+            while (reader.readFrame(&frame)) {
+                onFrame(frame);
+            }
+        });
+        socket->connectToHost("127.0.0.1", BenchPort);
+        clients.append(socket);
+        return socket;
+    }
+
+    NetworkEngine *const engine;
+
+private:
+    QThread thread;
+    QVector<QTcpSocket*> clients;
+};
+
+void DrawItBenchmarks::fanOut_data() {
+    QTest::addColumn<int>("clients");
+    for (int clients : {1, 4, 16, 64}) {
+        QTest::newRow(qPrintable(QString::number(clients))) << clients;
+    }
+}
+
+void DrawItBenchmarks::fanOut() {
+    QFETCH(int, clients);
+
+    BenchHost host(clients);
+    NetworkEngine *engine = host.engine;
+
+    // Only relayed canvas frames count towards what a client received, so
+    // the host's pings cannot make a round look finished early.
+    QVector<bool> synced(clients, false);
+    QVector<qint64> received(clients, 0);
+    for (int i = 0; i < clients; ++i) {
+        host.addClient([&synced, &received, i](const Protocol::Frame &frame) {
+            if (frame.opcode == Protocol::SnapshotDone) {
+                synced[i] = true;
+            } else if (Protocol::isCanvasOpcode(frame.opcode)) {
+                received[i] += Protocol::HeaderSize + frame.payload.size();
+            }
+        });
+    }
+
+    int joined = 0;
+    auto drainEvents = [engine, &joined]() {
+        NetEvent event;
+        while (engine->takeEvent(&event)) {
+            if (event.type == NetEvent::PeerJoined) {
+                engine->beginSnapshot(event.peer, 0);
+                engine->sendSnapshot(event.peer, Protocol::encodeSnapshot(QByteArray()));
+                ++joined;
+            }
+        }
+    };
+    auto allReceived = [&received](qint64 bytes) {
+        for (qint64 count : received) {
+            if (count < bytes) return false;
+        }
+        return true;
+    };
+    QVERIFY(QTest::qWaitFor([&]() { drainEvents(); return joined == clients && !synced.contains(false); }, 10000));
+
+    QRandomGenerator random(1);
+    QVector<QPoint> walk = randomWalk(random, 32 * 16 + 1);
+    QByteArray frames = Protocol::encodeStrokeBegin(walk[0], 5, 0xff000000);
+    for (int i = 1; i < walk.size(); i += 16) {
+        frames.append(Protocol::encodeStrokePoints(walk[i - 1], walk.mid(i, 16)));
+    }
+    frames.append(Protocol::encodeStrokeEnd());
+
+    QBENCHMARK {
+        received.fill(0);
+        FrameReader reader;
+        reader.append(frames);
+        Protocol::Frame frame;
+        while (reader.readFrame(&frame)) {
+            engine->send(Protocol::encodeFrame(frame.opcode, frame.payload));
+        }
+        QVERIFY(QTest::qWaitFor([&]() { drainEvents(); return allReceived(frames.size()); }, 10000));
+    }
+}
+
+void DrawItBenchmarks::largeSnapshot() {
+    BenchHost host(1);
+    NetworkEngine *engine = host.engine;
+
+    int snapshots = 0;
+    int strokeFrames = 0;
+    QTcpSocket *socket = host.addClient([&](const Protocol::Frame &frame) {
+        if (frame.opcode == Protocol::SnapshotDone) {
+            ++snapshots;
+        } else if (Protocol::isCanvasOpcode(frame.opcode)) {
+            ++strokeFrames;
+        }
+    });
+
+    // Four times the high-water mark, as the canvas of a busy room can be.
+    QByteArray image(1024 * 1024, Qt::Uninitialized);
+    QRandomGenerator random(1);
+    random.fillRange(reinterpret_cast<quint32 *>(image.data()), image.size() / 4);
+
+    // Answer resync requests the way GameWindow does, so a host that keeps
+    // asking shows up as extra snapshots instead of a hang.
+    int resyncs = 0;
+    auto drainEvents = [&]() {
+        NetEvent event;
+        while (engine->takeEvent(&event)) {
+            if (event.type == NetEvent::ResyncRequested) ++resyncs;
+            if (event.type == NetEvent::PeerJoined || event.type == NetEvent::ResyncRequested) {
+                engine->beginSnapshot(event.peer, 0);
+                engine->sendSnapshot(event.peer, Protocol::encodeSnapshot(image));
+            }
+        }
+    };
+    QVERIFY(QTest::qWaitFor([&]() { drainEvents(); return snapshots > 0; }, 10000));
+
+    engine->send(Protocol::encodeStrokeBegin(QPoint(10, 10), 5, 0xff000000));
+    engine->send(Protocol::encodeStrokeEnd());
+    QVERIFY(QTest::qWaitFor([&]() { drainEvents(); return strokeFrames == 2; }, 10000));
+    QCOMPARE(resyncs, 0);
+    QCOMPARE(snapshots, 1);
+    QCOMPARE(socket->state(), QAbstractSocket::ConnectedState);
+}
+
+void DrawItBenchmarks::undoAfterCompaction() {
+    DrawingArea compacted;
+    DrawingArea kept;
+    compacted.setHistoryLimits(1, 0);
+    QSignalSpy compactions(&compacted, &DrawingArea::strokesCompacted);
+
+    QRandomGenerator random(1);
+    quint32 strokes = 0;
+    auto draw = [&](quint16 owner) {
+        const QVector<QPoint> walk = randomWalk(random, 16);
+        // Colors tell the strokes apart once compaction has renumbered them.
+        const QColor color = QColor::fromRgb(0xff000000 | ++strokes);
+        for (DrawingArea *area : {&compacted, &kept}) {
+            int stroke = area->beginStroke(walk[0], 3, color, owner);
+            for (int i = 1; i < walk.size(); ++i) {
+                area->extendStroke(stroke, walk[i]);
+            }
+            area->endStroke(stroke);
+        }
+    };
+
+    // Player 3 only draws at the start, so the oldest strokes stay undoable
+    // and compaction has to flatten around them.
+    for (int i = 0; i < 5; ++i) draw(3);
+    for (int i = 0; i < 400; ++i) draw(quint16(1 + i % 2));
+    QVERIFY(QTest::qWaitFor([&]() { return compactions.count() == 1; }, 10000));
+    draw(1);
+    QVERIFY(QTest::qWaitFor([&]() { return compactions.count() == 2; }, 10000));
+    QVERIFY(compacted.strokeStore().strokeCount() < kept.strokeStore().strokeCount() / 2);
+
+    for (quint16 owner = 1; owner <= 3; ++owner) {
+        for (int i = 0; i < 100; ++i) QCOMPARE(compacted.undo(owner), kept.undo(owner));
+        for (int i = 0; i < 10; ++i) QCOMPARE(compacted.redo(owner), kept.redo(owner));
+    }
+
+    QHash<QRgb, bool> undone;
+    int undoneStrokes = 0;
+    const StrokeStore &reference = kept.strokeStore();
+    for (int i = 0; i < reference.strokeCount(); ++i) {
+        undone.insert(reference.stroke(i).color, reference.stroke(i).undone);
+        if (reference.stroke(i).undone) ++undoneStrokes;
+    }
+    const StrokeStore &store = compacted.strokeStore();
+    for (int i = 0; i < store.strokeCount(); ++i) {
+        QCOMPARE(store.stroke(i).undone, undone.value(store.stroke(i).color));
+        if (store.stroke(i).undone) --undoneStrokes;
+    }
+    QCOMPARE(undoneStrokes, 0);
+}
+
+QTEST_MAIN(DrawItBenchmarks)
+
+#include "benchmarks.moc"
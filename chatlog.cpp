@@ -0,0 +1,106 @@
+#include "chatlog.h"
+#include <QAbstractItemView>
+#include <QPainter>
+#include <climits>
+
+static const int BubbleMargin = 5;
+static const int BubblePadding = 8;
+static const int BubbleRadius = 10;
+static const QColor BubbleColor(0xE1, 0xF5, 0xFE);
+
+ChatLogModel::ChatLogModel(QObject *parent) : QAbstractListModel(parent), messages(DefaultCapacity), head(0), count(0) {
+}
+
+void ChatLogModel::setCapacity(int capacity) {
+    capacity = qMax(1, capacity);
+    if (capacity == messages.size()) return;
+    beginResetModel();
+    int kept = qMin(count, capacity);
+    QVector<QString> resized(capacity);
+    for (int i = 0; i < kept; ++i) {
+        resized[i] = at(count - kept + i);
+    }
+    messages = resized;
+    head = 0;
+    count = kept;
+    endResetModel();
+}
+
+void ChatLogModel::append(const QStringList &batch) {
+    if (batch.isEmpty()) return;
+    const int capacity = messages.size();
+    if (batch.size() >= capacity) {
+        beginResetModel();
+        for (int i = 0; i < capacity; ++i) {
+            messages[i] = batch[batch.size() - capacity + i];
+        }
+        head = 0;
+        count = capacity;
+        endResetModel();
+        return;
+    }
+
+    int overflow = count + batch.size() - capacity;
+    if (overflow > 0) {
+        beginRemoveRows(QModelIndex(), 0, overflow - 1);
+        for (int i = 0; i < overflow; ++i) {
+            messages[(head + i) % capacity].clear();
+        }
+        head = (head + overflow) % capacity;
+        count -= overflow;
+        endRemoveRows();
+    }
+    beginInsertRows(QModelIndex(), count, count + batch.size() - 1);
+    for (const QString &message : batch) {
+        messages[(head + count) % capacity] = message;
+        ++count;
+    }
+    endInsertRows();
+}
+
+void ChatLogModel::clear() {
+    if (count == 0) return;
+    beginResetModel();
+    messages = QVector<QString>(messages.size());
+    head = 0;
+    count = 0;
+    endResetModel();
+}
+
+int ChatLogModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : count;
+}
+
+QVariant ChatLogModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= count || role != Qt::DisplayRole) return QVariant();
+    return at(index.row());
+}
+
+// Rows span the viewport, so the wrap width comes from the view rather than
+// the option, which QListView leaves empty when it asks for a size hint.
+static int rowWidth(const QStyleOptionViewItem &option) {
+    const QAbstractItemView *view = qobject_cast<const QAbstractItemView *>(option.widget);
+    return view ? view->viewport()->width() : option.rect.width();
+}
+
+void ChatLogDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
+    QRect bubble = option.rect.adjusted(BubbleMargin, BubbleMargin, -BubbleMargin, -BubbleMargin);
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(BubbleColor);
+    painter->drawRoundedRect(bubble, BubbleRadius, BubbleRadius);
+    painter->setFont(option.font);
+    painter->setPen(option.palette.color(QPalette::Text));
+    painter->drawText(bubble.adjusted(BubblePadding, BubblePadding, -BubblePadding, -BubblePadding),
+                      Qt::TextWordWrap, index.data().toString());
+    painter->restore();
+}
+
+QSize ChatLogDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const {
+    const int inset = 2 * (BubbleMargin + BubblePadding);
+    const int width = rowWidth(option);
+    QRect text = option.fontMetrics.boundingRect(QRect(0, 0, qMax(1, width - inset), INT_MAX),
+                                                 Qt::TextWordWrap, index.data().toString());
+    return QSize(width, text.height() + inset);
+}
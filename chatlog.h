@@ -0,0 +1,44 @@
+#ifndef CHATLOG_H
+#define CHATLOG_H
+
+#include <QAbstractListModel>
+#include <QStyledItemDelegate>
+#include <QStringList>
+#include <QVector>
+
+// Chat history kept in a fixed-size ring: once the cap is reached the
+// oldest lines are dropped as new ones arrive, so a long or spammy room
+// costs bounded memory and the view only ever has capacity() rows.
+// Messages are added in batches so a burst becomes one insert.
+class ChatLogModel : public QAbstractListModel {
+public:
+    static const int DefaultCapacity = 1000;
+
+    explicit ChatLogModel(QObject *parent = nullptr);
+    int capacity() const { return messages.size(); }
+    void setCapacity(int capacity);
+    void append(const QStringList &batch);
+    void clear();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    const QString &at(int row) const { return messages[(head + row) % messages.size()]; }
+
+    QVector<QString> messages;
+    int head;
+    int count;
+};
+
+// Draws each line as a rounded bubble with wrapped plain text, sized from
+// font metrics alone, so a row costs nothing until the view asks for it.
+class ChatLogDelegate : public QStyledItemDelegate {
+public:
+    using QStyledItemDelegate::QStyledItemDelegate;
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+};
+
+#endif
@@ -7,35 +7,573 @@
 #include <QTranslator>
 #include <QApplication>
 #include <QListWidget>
+#include <QListWidgetItem>
+#include <QSignalBlocker>
+#include <QListView>
+#include <QScrollBar>
 #include <QFile>
 #include <QStatusBar>
 #include <QPainter>
+#include <QPaintEvent>
 #include <QMouseEvent>
 #include <QColorDialog>
 #include <QFontDatabase>
 #include <QInputDialog>
+#include <QShortcut>
+#include <QTimer>
+#include <QThread>
+#include <QBuffer>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QFileDialog>
+#include <limits>
+#include <algorithm>
+#include <QSlider>
+#include <QtEndian>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QScreen>
 
 static QTranslator *translator = nullptr;
 
-DrawingArea::DrawingArea(QWidget *parent) : QWidget(parent), drawing(false), currentBrushSize(2), currentBrushColor(Qt::black) {
+// The frames are stamped with origin, unsequenced, so a snapshot can hand
+// each unsettled stroke to the player who drew it.
+static void appendStrokeFrames(QByteArray &out, const StrokeStore &strokes, int index, quint16 origin = 0) {
+    static const int PointsPerFrame = 4096;
+
+    auto append = [&out, origin](QByteArray frame) {
+        Protocol::stampFrame(&frame, 0, origin, 0);
+        out.append(frame);
+    };
+    const Stroke &stroke = strokes.stroke(index);
+    QPoint previous = strokes.point(index, 0);
+    append(Protocol::encodeStrokeBegin(previous, stroke.brushSize, stroke.color));
+    QVector<QPoint> points;
+    for (quint32 i = 1; i < stroke.pointCount; ++i) {
+        points.append(strokes.point(index, int(i)));
+        if (points.size() == PointsPerFrame || i + 1 == stroke.pointCount) {
+            append(Protocol::encodeStrokePoints(previous, points));
+            previous = points.last();
+            points.clear();
+        }
+    }
+    if (stroke.finished) {
+        append(Protocol::encodeStrokeEnd());
+    }
+}
+
+// Each player can undo their last UndoDepth strokes. Every peer sees a
+// player's strokes, undos and redos in the same order and trims the history
+// the same way, and only strokes that have dropped out of it are ever
+// flattened, so an Undo takes back the same stroke everywhere.
+static const int UndoDepth = 64;
+
+// Composites the way the canvas does, layer by layer: each layer's base
+// and then every live stroke of its owner outside the tail, which stays
+// vectors.
+static QByteArray renderSettledCanvas(const CanvasState &state) {
+    const StrokeStore &strokes = state.strokes;
+    QImage image = state.base;
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    for (const QPair<quint16, QImage> &layer : state.layers) {
+        if (!layer.second.isNull()) {
+            painter.drawImage(0, 0, layer.second);
+        }
+        for (int i = 0; i < strokes.strokeCount(); ++i) {
+            const Stroke &stroke = strokes.stroke(i);
+            if (stroke.owner != layer.first || stroke.undone || stroke.baked || !stroke.finished) continue;
+            if (std::binary_search(state.tail.begin(), state.tail.end(), i)) continue;
+            DrawingArea::paintStroke(&painter, strokes, i);
+        }
+    }
+    painter.end();
+
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+    return png;
+}
+
+// Undone strokes in the tail are replayed and then taken back again with
+// one Undo per stroke, so they can still be redone.
+static QByteArray encodeUndoFrames(int count, quint16 origin) {
+    QByteArray out;
+    for (int i = 0; i < count; ++i) {
+        QByteArray frame = Protocol::encodeUndo();
+        Protocol::stampFrame(&frame, 0, origin, 0);
+        out.append(frame);
+    }
+    return out;
+}
+
+static QByteArray encodeCanvasSnapshot(const CanvasState &state) {
+    auto origin = [](quint16 owner) { return owner == 0 ? Protocol::HostPlayer : owner; };
+    QByteArray out = Protocol::encodeSnapshot(renderSettledCanvas(state));
+    for (int stroke : state.tail) {
+        appendStrokeFrames(out, state.strokes, stroke, origin(state.strokes.stroke(stroke).owner));
+    }
+    for (auto it = state.redoable.constBegin(); it != state.redoable.constEnd(); ++it) {
+        out.append(encodeUndoFrames(it.value(), origin(it.key())));
+    }
+    return out;
+}
+
+// A recording keyframe is [png size u32][png] followed by the unsettled
+// strokes and then each player's redoable count as Undo frames, all as
+// [owner u16][size u32][frames], so replay can restore who was drawing what
+// and keep undo and redo working across the seek.
+static QByteArray encodeKeyframe(const CanvasState &state) {
+    QByteArray png = renderSettledCanvas(state);
+    char size[4];
+    qToLittleEndian(quint32(png.size()), size);
+    QByteArray out = QByteArray(size, 4) + png;
+    auto append = [&out](quint16 owner, const QByteArray &frames) {
+        char header[6];
+        qToLittleEndian(owner, header);
+        qToLittleEndian(quint32(frames.size()), header + 2);
+        out.append(header, 6);
+        out.append(frames);
+    };
+    for (int stroke : state.tail) {
+        QByteArray frames;
+        appendStrokeFrames(frames, state.strokes, stroke);
+        append(state.strokes.stroke(stroke).owner, frames);
+    }
+    for (auto it = state.redoable.constBegin(); it != state.redoable.constEnd(); ++it) {
+        append(it.key(), encodeUndoFrames(it.value(), 0));
+    }
+    return out;
+}
+
+// Flattens the settled strokes onto their owners' layer bases, for
+// bakeHistory(). With cleared set, bases are the ones cleared layers are drawn
+// from on this canvas: only those layers are baked, and without the strokes
+// cleared from it. Only layers that gained strokes are returned.
+static QHash<quint16, QImage> bakeStrokes(QHash<quint16, QImage> bases, const QSize &size, const StrokeStore &strokes, const QVector<int> &settled, bool cleared) {
+    QHash<quint16, QImage> baked;
+    for (int i : settled) {
+        const Stroke &stroke = strokes.stroke(i);
+        if (stroke.undone) continue;
+        if (cleared && (stroke.hidden || !bases.contains(stroke.owner))) continue;
+        if (!baked.contains(stroke.owner)) {
+            QImage base = bases.value(stroke.owner);
+            if (base.isNull()) {
+                base = QImage(size, QImage::Format_ARGB32_Premultiplied);
+                base.fill(Qt::transparent);
+            }
+            baked.insert(stroke.owner, base);
+        }
+        QPainter painter(&baked[stroke.owner]);
+        painter.setRenderHint(QPainter::Antialiasing);
+        DrawingArea::paintStroke(&painter, strokes, i);
+    }
+    return baked;
+}
+
+static int environmentLimit(const char *name, int fallback) {
+    return qEnvironmentVariableIsSet(name) ? qEnvironmentVariableIntValue(name) : fallback;
+}
+
+static const int MinBakedStrokes = 32;
+static const int MinCompactedStrokes = 32;
+static const int DefaultHistoryPoints = 250000;
+static const int DefaultHistoryAgeSeconds = 600;
+static const QRect OverlayRect(8, 8, 330, 110);
+static const int MetricsDumpIntervalMs = 10000;
+static const double DefaultSimplifyTolerance = 0.5;
+static const int ChatFlushIntervalMs = 16;
+
+DrawingArea::DrawingArea(QWidget *parent) : QWidget(parent), tiles(QSize(1000, 600)), index(QSize(1000, 600)), localStroke(-1), currentBrushSize(2), currentBrushColor(Qt::black), simplifyTolerance(DefaultSimplifyTolerance), historyPointLimit(0), historyAgeLimit(0), bakingStrokes(0), canvasGeneration(0), pendingInputAt(0), pendingRemoteAt(0), overlayVisible(false) {
     setFixedSize(1000, 600);
     setStyleSheet("background-color: white; border: 2px solid #4A90E2; border-radius: 10px;");
+
+    overlayTimer = new QTimer(this);
+    connect(overlayTimer, &QTimer::timeout, this, [this]() { update(OverlayRect); });
 }
 
-void DrawingArea::addPoint(const QPoint &point) {
-    points.append(point);
-    brushSizes.append(currentBrushSize);
-    brushColors.append(currentBrushColor);
-    update();
+int DrawingArea::beginStroke(const QPoint &point, int brushSize, const QColor &brushColor, quint16 owner) {
+    int stroke = strokes.beginStroke(point, brushSize, brushColor, owner);
+    finishTimes.append(0);
+    index.insert(strokes, stroke, 0);
+    update(tiles.drawSegment(strokes, stroke, 0));
+    return stroke;
+}
+
+void DrawingArea::extendStroke(int stroke, const QPoint &point) {
+    strokes.appendPoint(stroke, point);
+    const Stroke &record = strokes.stroke(stroke);
+    if (record.finished) return;
+    index.insert(strokes, stroke, int(record.pointCount) - 1);
+    update(tiles.drawSegment(strokes, stroke, int(record.pointCount) - 1));
+}
+
+void DrawingArea::endStroke(int stroke) {
+    if (strokes.stroke(stroke).finished) return;
+    strokes.endStroke(stroke);
+    if (simplifyTolerance > 0) {
+        simplifyStroke(stroke);
+    }
+    finishTimes[stroke] = ClientMetrics::now();
+    tiles.cacheStrokePath(strokes, stroke);
+    quint16 owner = strokes.stroke(stroke).owner;
+    QVector<int> &history = undoHistory[owner];
+    history.append(stroke);
+    if (history.size() > UndoDepth) {
+        history.removeFirst();
+    }
+    redoHistory[owner].clear();
+    bakeHistory();
+    compactHistory();
+}
+
+void DrawingArea::simplifyStroke(int stroke) {
+    if (strokes.stroke(stroke).pointCount <= 2) return;
+    QVector<quint32> orders;
+    index.removeStroke(strokes, stroke, &orders);
+    const QVector<int> kept = strokes.simplify(stroke, simplifyTolerance);
+    for (int i = 0; i < kept.size(); ++i) {
+        quint32 order = orders[kept[i]];
+        if (order == std::numeric_limits<quint32>::max()) {
+            index.insert(strokes, stroke, i);
+        } else {
+            index.insert(strokes, stroke, i, order);
+        }
+    }
+}
+
+void DrawingArea::setSimplifyTolerance(double tolerance) {
+    simplifyTolerance = tolerance;
+}
+
+// A limit of 0 turns that trigger off.
+void DrawingArea::setHistoryLimits(int maxPoints, int maxAgeSeconds) {
+    historyPointLimit = qMax(0, maxPoints);
+    historyAgeLimit = qint64(qMax(0, maxAgeSeconds)) * 1000000;
+}
+
+QVector<bool> DrawingArea::undoableStrokes() const {
+    QVector<bool> undoable(strokes.strokeCount());
+    for (const QVector<int> &history : undoHistory) {
+        for (int stroke : history) undoable[stroke] = true;
+    }
+    for (const QVector<int> &history : redoHistory) {
+        for (int stroke : history) undoable[stroke] = true;
+    }
+    return undoable;
+}
+
+// Layer bases are the full ones, not what a local clear left on screen.
+// The tail is every stroke an undo or redo can still reach and every
+// stroke not finished yet, in stroke order.
+CanvasState DrawingArea::canvasState() const {
+    CanvasState state;
+    state.base = tiles.baseImage();
+    for (quint16 owner : tiles.layerOwners()) {
+        state.layers.append(qMakePair(owner, tiles.layerBase(owner)));
+    }
+    state.strokes = strokes;
+    const QVector<bool> undoable = undoableStrokes();
+    for (int i = 0; i < strokes.strokeCount(); ++i) {
+        if (undoable[i] || !strokes.stroke(i).finished) state.tail.append(i);
+    }
+    for (auto it = redoHistory.constBegin(); it != redoHistory.constEnd(); ++it) {
+        if (!it.value().isEmpty()) state.redoable.insert(it.key(), it.value().size());
+    }
+    return state;
+}
+
+// Strokes no undo or redo can reach any more that are not baked yet.
+QVector<int> DrawingArea::unbakedStrokes() const {
+    const QVector<bool> undoable = undoableStrokes();
+    QVector<int> unbaked;
+    for (int i = 0; i < strokes.strokeCount(); ++i) {
+        const Stroke &stroke = strokes.stroke(i);
+        if (stroke.finished && !stroke.baked && !undoable[i]) unbaked.append(i);
+    }
+    return unbaked;
+}
+
+// Once a batch of strokes has left undo's reach, they are painted onto
+// copies of their owners' layer bases on the thread pool, and those of
+// cleared layers also onto the bases this canvas draws them from. This runs
+// whether or not the history is ever compacted, so rebuilding a layer tile
+// after an undo redraws at most the strokes still within reach plus a
+// batch, however long the session. No history holds the strokes, so nothing
+// can touch them while that runs; anything else keeps drawing.
+void DrawingArea::bakeHistory() {
+    if (bakingStrokes > 0) return;
+    const QVector<int> settled = unbakedStrokes();
+    if (settled.size() < MinBakedStrokes) return;
+
+    bakingStrokes = settled.size();
+    const quint32 generation = canvasGeneration;
+    StrokeStore store = strokes;
+    QHash<quint16, QImage> bases;
+    QHash<quint16, QImage> clearedBases;
+    for (quint16 owner : tiles.layerOwners()) {
+        bases.insert(owner, tiles.layerBase(owner));
+        if (tiles.isLayerCleared(owner)) clearedBases.insert(owner, tiles.clearedLayerBase(owner));
+    }
+    const QSize canvasSize = tiles.size();
+    typedef QPair<QHash<quint16, QImage>, QHash<quint16, QImage>> Baked;
+    QFutureWatcher<Baked> *watcher = new QFutureWatcher<Baked>(this);
+    connect(watcher, &QFutureWatcher<Baked>::finished, this, [this, watcher, generation, settled]() {
+        watcher->deleteLater();
+        if (generation != canvasGeneration) return;
+        bakingStrokes = 0;
+        finishBaking(settled, watcher->result().first, watcher->result().second);
+    });
+    watcher->setFuture(QtConcurrent::run([bases, clearedBases, canvasSize, store, settled]() {
+        return Baked(bakeStrokes(bases, canvasSize, store, settled, false), bakeStrokes(clearedBases, canvasSize, store, settled, true));
+    }));
+}
+
+// The layers already show the baked strokes, so their new bases are only
+// needed the next time a layer tile is rebuilt; the strokes leave the index
+// at the same time, so that rebuild does not draw them again.
+void DrawingArea::finishBaking(const QVector<int> &settled, const QHash<quint16, QImage> &bases, const QHash<quint16, QImage> &clearedBases) {
+    for (auto it = bases.constBegin(); it != bases.constEnd(); ++it) {
+        tiles.setLayerBase(it.key(), it.value());
+    }
+    for (auto it = clearedBases.constBegin(); it != clearedBases.constEnd(); ++it) {
+        tiles.setClearedLayerBase(it.key(), it.value());
+    }
+    for (int stroke : settled) {
+        const Stroke &record = strokes.stroke(stroke);
+        if (!record.undone && !record.hidden) index.removeStroke(strokes, stroke);
+        strokes.setBaked(stroke, true);
+    }
+    compactHistory();
+    bakeHistory();
+}
+
+// Baked strokes that can be dropped: past the age limit, or needed to bring
+// the point count back down to half the limit. Age alone waits for a batch
+// worth renumbering everything for.
+QVector<int> DrawingArea::discardableStrokes() const {
+    const qint64 now = ClientMetrics::now();
+    qint64 remaining = strokes.pointCount();
+    const bool oversized = historyPointLimit > 0 && remaining > historyPointLimit;
+    QVector<int> discarded;
+    for (int i = 0; i < strokes.strokeCount(); ++i) {
+        const Stroke &stroke = strokes.stroke(i);
+        if (!stroke.baked) continue;
+        bool expired = historyAgeLimit > 0 && now - finishTimes[i] > historyAgeLimit;
+        if (!expired && !(oversized && remaining > historyPointLimit / 2)) break;
+        remaining -= stroke.pointCount;
+        discarded.append(i);
+    }
+    if (!oversized && discarded.size() < MinCompactedStrokes) discarded.clear();
+    return discarded;
+}
+
+// Compaction only drops the vectors of strokes that are already baked into
+// their layers, so it never has to redraw anything. It waits while a bake
+// is in flight, since that holds on to stroke indices.
+void DrawingArea::compactHistory() {
+    if (bakingStrokes > 0 || (historyPointLimit == 0 && historyAgeLimit == 0)) return;
+    const QVector<int> discarded = discardableStrokes();
+    if (discarded.isEmpty()) return;
+
+    strokes.discard(discarded);
+    index.discard(discarded);
+    tiles.discardStrokes(discarded);
+    int kept = 0;
+    for (int i = 0, next = 0; i < finishTimes.size(); ++i) {
+        if (next < discarded.size() && discarded[next] == i) {
+            ++next;
+            continue;
+        }
+        finishTimes[kept++] = finishTimes[i];
+    }
+    finishTimes.resize(kept);
+    for (QVector<int> &history : undoHistory) {
+        for (int &stroke : history) stroke = StrokeStore::renumbered(discarded, stroke);
+    }
+    for (QVector<int> &history : redoHistory) {
+        for (int &stroke : history) stroke = StrokeStore::renumbered(discarded, stroke);
+    }
+    if (localStroke >= 0) {
+        localStroke = StrokeStore::renumbered(discarded, localStroke);
+    }
+    emit strokesCompacted(discarded);
+}
+
+bool DrawingArea::undo(quint16 owner) {
+    QVector<int> &history = undoHistory[owner];
+    if (history.isEmpty()) return false;
+    int stroke = history.takeLast();
+    redoHistory[owner].append(stroke);
+
+    index.removeStroke(strokes, stroke);
+    strokes.setUndone(stroke, true);
+
+    QRect bounds = strokes.stroke(stroke).bounds();
+    int margin = strokes.stroke(stroke).brushSize / 2 + 2;
+    bounds.adjust(-margin, -margin, margin, margin);
+    tiles.invalidate(bounds, owner);
+    update(bounds);
+    return true;
+}
+
+bool DrawingArea::redo(quint16 owner) {
+    QVector<int> &pending = redoHistory[owner];
+    if (pending.isEmpty()) return false;
+    int stroke = pending.takeLast();
+    undoHistory[owner].append(stroke);
+    strokes.setUndone(stroke, false);
+    // Cleared from this canvas, so it is only back for everyone else.
+    if (strokes.stroke(stroke).hidden) return true;
+    tiles.cacheStrokePath(strokes, stroke);
+
+    QRect dirty;
+    int count = int(strokes.stroke(stroke).pointCount);
+    for (int i = 0; i < count; ++i) {
+        index.insert(strokes, stroke, i);
+        dirty |= tiles.drawSegment(strokes, stroke, i);
+    }
+    update(dirty);
+    return true;
 }
 
 void DrawingArea::clear() {
-    points.clear();
-    brushSizes.clear();
-    brushColors.clear();
+    strokes.clear();
+    finishTimes.clear();
+    bakingStrokes = 0;
+    ++canvasGeneration;
+    localStroke = -1;
+    tiles.clear();
+    index.clear();
+    undoHistory.clear();
+    redoHistory.clear();
+    update();
+}
+
+void DrawingArea::setPlayerVisible(quint16 owner, bool visible) {
+    tiles.setLayerVisible(owner, visible);
+    update();
+}
+
+// The player's strokes only leave this canvas: they stay live, undoable
+// and part of every snapshot, and so does their layer's base. Only the
+// player's own layer is rebuilt. A stroke they are still drawing is kept so
+// it carries on; a bake in flight is dropped, since it does not know which
+// strokes are cleared.
+void DrawingArea::clearPlayer(quint16 owner) {
+    for (int stroke = 0; stroke < strokes.strokeCount(); ++stroke) {
+        const Stroke &record = strokes.stroke(stroke);
+        if (record.owner != owner || record.hidden || !record.finished) continue;
+        index.removeStroke(strokes, stroke);
+        strokes.setHidden(stroke, true);
+    }
+    bakingStrokes = 0;
+    ++canvasGeneration;
+    tiles.clearLayer(owner);
     update();
 }
 
+QVector<int> DrawingArea::strokesIn(const QRect &rect) const {
+    return index.strokesIn(strokes, rect);
+}
+
+int DrawingArea::strokeAt(const QPoint &point, int radius) const {
+    const QVector<SegmentRef> hits = index.queryRadius(strokes, point, radius);
+    return hits.isEmpty() ? -1 : hits.last().stroke;
+}
+
+// A stroke the mouse is still drawing is carried over, so the drag goes on
+// where it was: the batcher keeps sending it and the host, which leaves it
+// out of our snapshot, keeps extending its copy.
+void DrawingArea::loadSnapshot(const QImage &image) {
+    QVector<QPoint> drawn;
+    int brushSize = 0;
+    QRgb color = 0;
+    if (localStroke >= 0) {
+        const Stroke &drawing = strokes.stroke(localStroke);
+        brushSize = drawing.brushSize;
+        color = drawing.color;
+        for (quint32 i = 0; i < drawing.pointCount; ++i) {
+            drawn.append(strokes.point(localStroke, int(i)));
+        }
+    }
+    clear();
+    QImage base(size(), QImage::Format_ARGB32_Premultiplied);
+    base.fill(Qt::transparent);
+    QPainter painter(&base);
+    painter.drawImage(0, 0, image);
+    painter.end();
+    tiles.setBase(base);
+
+    if (!drawn.isEmpty()) {
+        localStroke = beginStroke(drawn.first(), brushSize, QColor::fromRgba(color));
+        for (int i = 1; i < drawn.size(); ++i) {
+            extendStroke(localStroke, drawn[i]);
+        }
+    }
+}
+
+void DrawingArea::markRemoteSample(qint64 receivedAt) {
+    if (pendingRemoteAt == 0 && receivedAt > 0) {
+        pendingRemoteAt = receivedAt;
+    }
+}
+
+void DrawingArea::recordPlayoutDelay(qint64 delay) {
+    frameMetrics.playoutDelay.record(quint64(qMax<qint64>(0, delay)));
+}
+
+void DrawingArea::setOverlayVisible(bool visible) {
+    overlayVisible = visible;
+    if (visible) {
+        overlayTimer->start(250);
+    } else {
+        overlayTimer->stop();
+    }
+    update(OverlayRect);
+}
+
+void DrawingArea::paintOverlay(QPainter *painter) {
+    auto line = [](const char *name, const Histogram &histogram, double scale, const char *unit) {
+        return QString("%1 p50 %2  p99 %3  max %4 %5").arg(QLatin1String(name))
+            .arg(histogram.percentile(0.5) / scale, 0, 'f', 1)
+            .arg(histogram.percentile(0.99) / scale, 0, 'f', 1)
+            .arg(histogram.maximum() / scale, 0, 'f', 1)
+            .arg(QLatin1String(unit));
+    };
+    QStringList lines;
+    lines << line("paint   ", frameMetrics.paintTime, 1000.0, "ms")
+          << line("segments", frameMetrics.segmentsPerFrame, 1.0, "")
+          << line("input   ", frameMetrics.inputToPixel, 1000.0, "ms")
+          << line("network ", frameMetrics.networkToPixel, 1000.0, "ms")
+          << line("playout ", frameMetrics.playoutDelay, 1000.0, "ms");
+
+    painter->fillRect(OverlayRect, QColor(0, 0, 0, 160));
+    painter->setPen(Qt::white);
+    painter->setFont(QFont("monospace", 9));
+    painter->drawText(OverlayRect.adjusted(8, 6, -8, -6), Qt::AlignLeft | Qt::AlignTop, lines.join('\n'));
+}
+
+void DrawingArea::paintStroke(QPainter *painter, const StrokeStore &store, int stroke) {
+    const Stroke &record = store.stroke(stroke);
+    const StrokePoint *points = store.strokePoints(stroke);
+    painter->setPen(QPen(QColor::fromRgba(record.color), record.brushSize, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+    if (record.pointCount == 1) {
+        painter->drawLine(points[0].toPoint(), points[0].toPoint());
+        return;
+    }
+    QPolygon polygon(int(record.pointCount));
+    for (quint32 i = 0; i < record.pointCount; ++i) {
+        polygon.setPoint(int(i), points[i].toPoint());
+    }
+    painter->drawPolyline(polygon);
+}
+
 void DrawingArea::setBrushSize(int size) {
     currentBrushSize = size;
 }
@@ -45,38 +583,49 @@ void DrawingArea::setBrushColor(const QColor &color) {
 }
 
 void DrawingArea::paintEvent(QPaintEvent *event) {
+    qint64 started = ClientMetrics::now();
+    if (tiles.hasDirtyTiles()) {
+        tiles.render(strokes, index);
+    }
     QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-    for (int i = 1; i < points.size(); ++i) {
-        painter.setPen(QPen(brushColors[i], brushSizes[i], Qt::SolidLine, Qt::RoundCap));
-        painter.drawLine(points[i-1], points[i]);
+    tiles.paint(&painter, event->rect());
+    if (overlayVisible && event->rect().intersects(OverlayRect)) {
+        paintOverlay(&painter);
+    }
+
+    qint64 finished = ClientMetrics::now();
+    frameMetrics.paintTime.record(quint64(finished - started));
+    frameMetrics.segmentsPerFrame.record(quint64(tiles.takeRasterizedSegments()));
+    if (pendingInputAt > 0) {
+        frameMetrics.inputToPixel.record(quint64(finished - pendingInputAt));
+        pendingInputAt = 0;
+    }
+    if (pendingRemoteAt > 0) {
+        frameMetrics.networkToPixel.record(quint64(finished - pendingRemoteAt));
+        pendingRemoteAt = 0;
     }
 }
 
 void DrawingArea::mousePressEvent(QMouseEvent *event) {
     if (event->button() == Qt::LeftButton) {
-        drawing = true;
-        points.append(event->pos());
-        brushSizes.append(currentBrushSize);
-        brushColors.append(currentBrushColor);
-        emit pointDrawn(event->pos(), currentBrushSize, currentBrushColor);
-        update();
+        localStroke = beginStroke(event->pos(), currentBrushSize, currentBrushColor);
+        emit strokeStarted(event->pos(), currentBrushSize, currentBrushColor);
     }
 }
 
 void DrawingArea::mouseMoveEvent(QMouseEvent *event) {
-    if (drawing) {
-        points.append(event->pos());
-        brushSizes.append(currentBrushSize);
-        brushColors.append(currentBrushColor);
+    if (localStroke >= 0) {
+        if (pendingInputAt == 0) pendingInputAt = ClientMetrics::now();
+        extendStroke(localStroke, event->pos());
         emit pointDrawn(event->pos(), currentBrushSize, currentBrushColor);
-        update();
     }
 }
 
 void DrawingArea::mouseReleaseEvent(QMouseEvent *event) {
-    if (event->button() == Qt::LeftButton) {
-        drawing = false;
+    if (event->button() == Qt::LeftButton && localStroke >= 0) {
+        endStroke(localStroke);
+        localStroke = -1;
+        emit strokeFinished();
     }
 }
 
@@ -114,10 +663,25 @@ void RoomSettingsDialog::onConfirmClicked() {
 ChatWidget::ChatWidget(QWidget *parent) : QWidget(parent) {
     QVBoxLayout *layout = new QVBoxLayout(this);
 
-    chatDisplay = new QTextEdit(this);
-    chatDisplay->setReadOnly(true);
-    chatDisplay->setStyleSheet("background-color: #F5F7FA; border: 1px solid #ccc; border-radius: 10px; padding: 10px; font-family: 'Roboto'; font-size: 14px;");
-    layout->addWidget(chatDisplay);
+    chatLog = new ChatLogModel(this);
+    chatView = new QListView(this);
+    chatView->setModel(chatLog);
+    chatView->setItemDelegate(new ChatLogDelegate(chatView));
+    chatView->setSelectionMode(QAbstractItemView::NoSelection);
+    chatView->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    chatView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    chatView->setResizeMode(QListView::Adjust);
+    chatView->setLayoutMode(QListView::Batched);
+    chatView->setStyleSheet("background-color: #F5F7FA; border: 1px solid #ccc; border-radius: 10px; padding: 10px; font-family: 'Roboto'; font-size: 14px;");
+    layout->addWidget(chatView);
+
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(ChatFlushIntervalMs);
+    connect(flushTimer, &QTimer::timeout, this, &ChatWidget::flushMessages);
+
+    int historyLimit = qEnvironmentVariableIntValue("DRAWIT_CHAT_HISTORY");
+    if (historyLimit > 0) setHistoryLimit(historyLimit);
 
     QHBoxLayout *inputLayout = new QHBoxLayout();
     chatInput = new QLineEdit(this);
@@ -141,7 +705,31 @@ ChatWidget::ChatWidget(QWidget *parent) : QWidget(parent) {
 }
 
 void ChatWidget::appendMessage(const QString &message) {
-    chatDisplay->append("<div style='background-color: #E1F5FE; border-radius: 10px; padding: 8px; margin: 5px;'>" + message + "</div>");
+    pendingMessages.append(message);
+    if (!flushTimer->isActive()) flushTimer->start();
+}
+
+void ChatWidget::flushMessages() {
+    QScrollBar *scrollBar = chatView->verticalScrollBar();
+    bool following = scrollBar->value() == scrollBar->maximum();
+    chatLog->append(pendingMessages);
+    pendingMessages.clear();
+    if (following) chatView->scrollToBottom();
+}
+
+void ChatWidget::clear() {
+    flushTimer->stop();
+    pendingMessages.clear();
+    chatLog->clear();
+}
+
+void ChatWidget::setHistoryLimit(int messages) {
+    chatLog->setCapacity(messages);
+}
+
+void ChatWidget::setInputVisible(bool visible) {
+    chatInput->setVisible(visible);
+    sendButton->setVisible(visible);
 }
 
 void ChatWidget::onSendMessage() {
@@ -174,6 +762,15 @@ JoinLobbyDialog::JoinLobbyDialog(QWidget *parent) : QDialog(parent) {
         );
     layout->addWidget(serverIpInput);
 
+    QLabel *roomLabel = new QLabel("Room ID (dedicated servers only):", this);
+    roomLabel->setStyleSheet("font-family: 'Roboto'; font-size: 14px; color: #333;");
+    layout->addWidget(roomLabel);
+
+    roomIdSpinBox = new QSpinBox(this);
+    roomIdSpinBox->setRange(0, 999999);
+    roomIdSpinBox->setStyleSheet("font-family: 'Roboto'; font-size: 14px; padding: 5px; border: 1px solid #ccc; border-radius: 5px;");
+    layout->addWidget(roomIdSpinBox);
+
     joinButton = new QPushButton("Join", this);
     joinButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
     layout->addWidget(joinButton);
@@ -187,8 +784,12 @@ QString JoinLobbyDialog::getServerIp() const {
     return serverIpInput->text();
 }
 
+quint32 JoinLobbyDialog::getRoomId() const {
+    return quint32(roomIdSpinBox->value());
+}
+
 void JoinLobbyDialog::onJoinClicked() {
-    emit joinRequested(serverIpInput->text());
+    emit joinRequested(serverIpInput->text(), getRoomId());
     accept();
 }
 
@@ -223,11 +824,13 @@ void PlayModeWindow::onJoinRoomClicked() {
     accept();
 }
 
-GameWindow::GameWindow(QWidget *parent, bool isServer, const QString &serverIp) : QDialog(parent), server(nullptr), maxPlayers(2) {
+GameWindow::GameWindow(QWidget *parent, bool isServer, const QString &serverIp, quint32 roomId) : QDialog(parent), hosting(isServer), appliedSequence(0), recordingSession(0) {
     QHBoxLayout *mainLayout = new QHBoxLayout(this);
 
     QVBoxLayout *leftLayout = new QVBoxLayout();
     drawingArea = new DrawingArea(this);
+    drawingArea->setHistoryLimits(environmentLimit("DRAWIT_HISTORY_POINTS", DefaultHistoryPoints),
+                                  environmentLimit("DRAWIT_HISTORY_AGE", DefaultHistoryAgeSeconds));
     leftLayout->addWidget(drawingArea);
 
     QHBoxLayout *toolsLayout = new QHBoxLayout();
@@ -239,142 +842,425 @@ GameWindow::GameWindow(QWidget *parent, bool isServer, const QString &serverIp)
     brushColorButton = new QPushButton("Pick Color", this);
     brushColorButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
     toolsLayout->addWidget(brushColorButton);
+
+    undoButton = new QPushButton("Undo", this);
+    undoButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+    toolsLayout->addWidget(undoButton);
+
+    redoButton = new QPushButton("Redo", this);
+    redoButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+    toolsLayout->addWidget(redoButton);
+
+    batchIntervalSpinBox = new QSpinBox(this);
+    batchIntervalSpinBox->setRange(0, 200);
+    batchIntervalSpinBox->setValue(16);
+    batchIntervalSpinBox->setPrefix("Batch: ");
+    batchIntervalSpinBox->setSuffix(" ms");
+    batchIntervalSpinBox->setStyleSheet("font-family: 'Roboto'; font-size: 14px; padding: 5px; border: 1px solid #ccc; border-radius: 5px;");
+    toolsLayout->addWidget(batchIntervalSpinBox);
+
+    recordButton = new QPushButton("Record", this);
+    recordButton->setCheckable(true);
+    recordButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+    toolsLayout->addWidget(recordButton);
+
+    statsButton = new QPushButton("Stats", this);
+    statsButton->setCheckable(true);
+    statsButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+    toolsLayout->addWidget(statsButton);
+
+    simplifySpinBox = new QDoubleSpinBox(this);
+    simplifySpinBox->setRange(0.0, 5.0);
+    simplifySpinBox->setSingleStep(0.25);
+    simplifySpinBox->setValue(DefaultSimplifyTolerance);
+    simplifySpinBox->setPrefix("Simplify: ");
+    simplifySpinBox->setSuffix(" px");
+    simplifySpinBox->setStyleSheet("font-family: 'Roboto'; font-size: 14px; padding: 5px; border: 1px solid #ccc; border-radius: 5px;");
+    toolsLayout->addWidget(simplifySpinBox);
+
+    uploadRateLabel = new QLabel("Upload: 0 B/s", this);
+    uploadRateLabel->setStyleSheet("font-family: 'Roboto'; font-size: 14px; color: #333;");
+    toolsLayout->addWidget(uploadRateLabel);
     leftLayout->addLayout(toolsLayout);
     mainLayout->addLayout(leftLayout, 3);
 
     QVBoxLayout *rightLayout = new QVBoxLayout();
+    roomStatsLabel = new QLabel("Room: no connections", this);
+    roomStatsLabel->setWordWrap(true);
+    roomStatsLabel->setStyleSheet("font-family: 'Roboto'; font-size: 14px; color: #333;");
+    rightLayout->addWidget(roomStatsLabel);
+
     playerList = new QListWidget(this);
     playerList->setStyleSheet("background-color: white; border: 1px solid #ccc; border-radius: 10px; padding: 5px; font-family: 'Roboto'; font-size: 14px;");
-    playerList->addItem("Player 1 (You)");
     rightLayout->addWidget(playerList, 1);
+    rebuildPlayerItems();
+
+    clearPlayerButton = new QPushButton("Clear Player", this);
+    clearPlayerButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+    rightLayout->addWidget(clearPlayerButton);
 
     chatWidget = new ChatWidget(this);
     rightLayout->addWidget(chatWidget, 2);
     mainLayout->addLayout(rightLayout, 1);
 
+    connect(drawingArea, &DrawingArea::strokeStarted, this, &GameWindow::onStrokeStarted);
     connect(drawingArea, &DrawingArea::pointDrawn, this, &GameWindow::onPointDrawn);
+    connect(drawingArea, &DrawingArea::strokeFinished, this, &GameWindow::onStrokeFinished);
+    connect(drawingArea, &DrawingArea::strokesCompacted, this, [this](const QVector<int> &discarded) {
+        for (int &stroke : remoteStrokes) {
+            stroke = StrokeStore::renumbered(discarded, stroke);
+        }
+    });
     connect(chatWidget, &ChatWidget::messageSent, this, &GameWindow::onSendMessage);
     connect(brushSizeCombo, QOverload<int>::of(&QComboBox::activated), this, &GameWindow::onBrushSizeChanged);
     connect(brushColorButton, &QPushButton::clicked, this, &GameWindow::onBrushColorChanged);
-
+    connect(batchIntervalSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &GameWindow::onBatchIntervalChanged);
+    connect(undoButton, &QPushButton::clicked, this, &GameWindow::onUndoClicked);
+    connect(redoButton, &QPushButton::clicked, this, &GameWindow::onRedoClicked);
+    connect(recordButton, &QPushButton::toggled, this, &GameWindow::onRecordToggled);
+    connect(statsButton, &QPushButton::toggled, this, &GameWindow::onStatsToggled);
+    connect(playerList, &QListWidget::itemChanged, this, &GameWindow::onPlayerItemChanged);
+    connect(clearPlayerButton, &QPushButton::clicked, this, &GameWindow::onClearPlayerClicked);
+    connect(new QShortcut(QKeySequence(Qt::Key_F3), this), &QShortcut::activated, statsButton, &QPushButton::toggle);
+    connect(new QShortcut(QKeySequence::Undo, this), &QShortcut::activated, this, &GameWindow::onUndoClicked);
+    connect(new QShortcut(QKeySequence::Redo, this), &QShortcut::activated, this, &GameWindow::onRedoClicked);
+
+    strokeBatcher = new StrokeBatcher(this);
+    strokeBatcher->setInterval(batchIntervalSpinBox->value());
+    strokeBatcher->setSimplifyTolerance(simplifySpinBox->value());
+    connect(simplifySpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &GameWindow::onSimplifyToleranceChanged);
+    connect(strokeBatcher, &StrokeBatcher::frameReady, this, &GameWindow::broadcastFrame);
+
+    QTimer *uploadRateTimer = new QTimer(this);
+    connect(uploadRateTimer, &QTimer::timeout, this, &GameWindow::updateUploadRate);
+    uploadRateTimer->start(1000);
+
+    QTimer *recordTimer = new QTimer(this);
+    connect(recordTimer, &QTimer::timeout, this, &GameWindow::onRecordTick);
+    recordTimer->start(1000);
+
+    QTimer *metricsTimer = new QTimer(this);
+    connect(metricsTimer, &QTimer::timeout, this, &GameWindow::dumpMetrics);
+    metricsTimer->start(MetricsDumpIntervalMs);
+
+    networkThread = new QThread(this);
+    networkEngine = new NetworkEngine();
+    networkEngine->moveToThread(networkThread);
+    connect(networkThread, &QThread::finished, networkEngine, &QObject::deleteLater);
+    networkThread->start();
+
+    NetworkEngine *engine = networkEngine;
     if (isServer) {
-        setupServer();
+        QMetaObject::invokeMethod(engine, [engine]() { engine->startServer(Protocol::DefaultPort); }, Qt::QueuedConnection);
     } else {
-        QTcpSocket *socket = new QTcpSocket(this);
-        socket->connectToHost(serverIp, 12345);
-        if (socket->waitForConnected()) {
-            clients.append(socket);
-            connect(socket, &QTcpSocket::readyRead, this, &GameWindow::readClientData);
-            connect(socket, &QTcpSocket::disconnected, this, &GameWindow::clientDisconnected);
-            chatWidget->appendMessage("Connected to server at " + serverIp);
-        } else {
-            chatWidget->appendMessage("Could not connect to server at " + serverIp);
-        }
+        QMetaObject::invokeMethod(engine, [engine, serverIp, roomId]() { engine->connectToHost(serverIp, Protocol::DefaultPort, roomId); }, Qt::QueuedConnection);
     }
 
+    QTimer *networkTimer = new QTimer(this);
+    connect(networkTimer, &QTimer::timeout, this, &GameWindow::processNetworkEvents);
+    networkTimer->start(16);
+
+    // Remote samples are let out once per display refresh; the timer only
+    // runs while some player still has samples buffered.
+    playbackTimer = new QTimer(this);
+    playbackTimer->setTimerType(Qt::PreciseTimer);
+    connect(playbackTimer, &QTimer::timeout, this, &GameWindow::releaseRemoteEvents);
+
     setWindowTitle("Draw It - Game");
     setStyleSheet("background: qlineargradient(x1:0, y1:0, x2:1, y2:1, stop:0 #A1C4FD, stop:1 #C2E9FB);");
     resize(1200, 800);
 }
 
 GameWindow::~GameWindow() {
-    for (QTcpSocket *client : clients) {
-        client->disconnectFromHost();
-    }
-    if (server) {
-        server->close();
-    }
+    recorder.close();
+    QMetaObject::invokeMethod(networkEngine, &NetworkEngine::shutdown, Qt::BlockingQueuedConnection);
+    networkThread->quit();
+    networkThread->wait();
 }
 
 void GameWindow::setMaxPlayers(int max) {
-    maxPlayers = max;
+    networkEngine->setMaxPlayers(max);
 }
 
-void GameWindow::setupServer() {
-    server = new QTcpServer(this);
-    if (!server->listen(QHostAddress::Any, 12345)) {
-        chatWidget->appendMessage("Server could not start!");
-        return;
+void GameWindow::processNetworkEvents() {
+    NetEvent event;
+    while (networkEngine->takeEvent(&event)) {
+        handleNetworkEvent(event);
+    }
+}
+
+void GameWindow::releaseRemoteEvents() {
+    QVector<NetEvent> due;
+    remotePlayback.release(ClientMetrics::now(), &due);
+    for (const NetEvent &event : due) {
+        applyRemoteEvent(event);
+    }
+    if (remotePlayback.isEmpty()) {
+        playbackTimer->stop();
+    }
+}
+
+void GameWindow::flushRemoteEvents() {
+    QVector<NetEvent> due;
+    remotePlayback.flush(&due);
+    for (const NetEvent &event : due) {
+        applyRemoteEvent(event);
     }
-    connect(server, &QTcpServer::newConnection, this, &GameWindow::handleNewConnection);
-    chatWidget->appendMessage("Server started on port 12345");
-    chatWidget->appendMessage("Your IP: " + server->serverAddress().toString());
+    playbackTimer->stop();
 }
 
-void GameWindow::handleNewConnection() {
-    if (clients.size() >= maxPlayers) {
-        QTcpSocket *client = server->nextPendingConnection();
-        client->disconnectFromHost();
+void GameWindow::handleNetworkEvent(const NetEvent &event) {
+    switch (event.type) {
+    case NetEvent::Status:
+        chatWidget->appendMessage(event.text);
+        break;
+    case NetEvent::PeerJoined:
+        remotePlayers.append(event.peer);
+        chatWidget->appendMessage(event.text);
+        refreshPlayerList();
+        sendSnapshot(event.peer);
+        break;
+    case NetEvent::PeerLeft:
+        flushRemoteEvents();
+        remotePlayback.forget(event.peer);
+        if (remoteStrokes.contains(event.peer)) {
+            drawingArea->endStroke(remoteStrokes.take(event.peer));
+            recorder.recordFrame(quint16(event.peer), Protocol::encodeStrokeEnd());
+        }
+        remotePlayers.removeAll(event.peer);
+        peerStats.remove(event.peer);
+        chatWidget->appendMessage(event.text);
+        refreshPlayerList();
+        break;
+    case NetEvent::Chat:
+        chatWidget->appendMessage(event.text);
+        recorder.recordFrame(quint16(event.peer), Protocol::encodeChat(event.text));
+        break;
+    case NetEvent::StrokeBegin:
+    case NetEvent::StrokePoints:
+    case NetEvent::StrokeEnd:
+    case NetEvent::Undo:
+    case NetEvent::Redo:
+        drawingArea->recordPlayoutDelay(remotePlayback.push(event));
+        if (!playbackTimer->isActive()) {
+            QScreen *display = screen();
+            qreal refreshRate = display ? display->refreshRate() : 60.0;
+            playbackTimer->start(qBound(1, qRound(1000.0 / refreshRate), 16));
+        }
         return;
+    case NetEvent::Snapshot:
+        // Anything still buffered was drawn before the snapshot was taken.
+        // The strokes that follow it include our own undoable ones, as peer
+        // 0, so replaying them rebuilds our undo and redo history too.
+        remotePlayback.clear();
+        playbackTimer->stop();
+        remoteStrokes.clear();
+        drawingArea->loadSnapshot(QImage::fromData(event.data, "PNG"));
+        if (recorder.isOpen()) {
+            captureKeyframe();
+        }
+        break;
+    case NetEvent::ResyncRequested:
+        sendSnapshot(event.peer);
+        break;
+    case NetEvent::PeerStatsUpdated:
+        if (!hosting || remotePlayers.contains(event.peer)) {
+            peerStats.insert(event.peer, event.stats);
+            refreshPlayerList();
+        }
+        break;
     }
-    QTcpSocket *client = server->nextPendingConnection();
-    clients.append(client);
-    connect(client, &QTcpSocket::readyRead, this, &GameWindow::readClientData);
-    connect(client, &QTcpSocket::disconnected, this, &GameWindow::clientDisconnected);
-    chatWidget->appendMessage("New player connected");
-    playerList->addItem("Player " + QString::number(clients.size() + 1));
-}
-
-void GameWindow::readClientData() {
-    QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
-    if (!client) return;
-
-    QDataStream in(client);
-    in.setVersion(QDataStream::Qt_5_15);
-    QString message;
-    QPoint point;
-    int brushSize;
-    QColor brushColor;
-
-    while (!in.atEnd()) {
-        QString type;
-        in >> type;
-        if (type == "message") {
-            in >> message;
-            chatWidget->appendMessage(message);
-            broadcastMessage(message);
-        } else if (type == "point") {
-            in >> point >> brushSize >> brushColor;
-            drawingArea->addPoint(point);
-            broadcastPoint(point, brushSize, brushColor);
+    appliedSequence = qMax(appliedSequence, event.sequence);
+}
+
+// Canvas events land here once the player's jitter buffer lets them go.
+void GameWindow::applyRemoteEvent(const NetEvent &event) {
+    switch (event.type) {
+    case NetEvent::StrokeBegin:
+        if (remoteStrokes.contains(event.peer)) {
+            drawingArea->endStroke(remoteStrokes.take(event.peer));
+        }
+        remoteStrokes.insert(event.peer, drawingArea->beginStroke(event.point, event.brushSize, QColor::fromRgba(event.color), quint16(event.peer)));
+        recorder.recordFrame(quint16(event.peer), Protocol::encodeStrokeBegin(event.point, event.brushSize, event.color));
+        break;
+    case NetEvent::StrokePoints:
+        if (remoteStrokes.contains(event.peer) && !event.points.isEmpty()) {
+            int stroke = remoteStrokes.value(event.peer);
+            drawingArea->markRemoteSample(event.receivedAt);
+            const StrokeStore &store = drawingArea->strokeStore();
+            QPoint origin = store.point(stroke, int(store.stroke(stroke).pointCount) - 1);
+            for (const QPoint &point : event.points) {
+                drawingArea->extendStroke(stroke, point);
+            }
+            recorder.recordFrame(quint16(event.peer), Protocol::encodeStrokePoints(origin, event.points));
         }
+        break;
+    case NetEvent::StrokeEnd:
+        if (remoteStrokes.contains(event.peer)) {
+            drawingArea->endStroke(remoteStrokes.take(event.peer));
+            recorder.recordFrame(quint16(event.peer), Protocol::encodeStrokeEnd());
+        }
+        break;
+    case NetEvent::Undo:
+        drawingArea->undo(quint16(event.peer));
+        recorder.recordFrame(quint16(event.peer), Protocol::encodeUndo());
+        break;
+    case NetEvent::Redo:
+        drawingArea->redo(quint16(event.peer));
+        recorder.recordFrame(quint16(event.peer), Protocol::encodeRedo());
+        break;
+    default:
+        break;
     }
+    appliedSequence = qMax(appliedSequence, event.sequence);
+}
+
+void GameWindow::sendSnapshot(int peer) {
+    flushRemoteEvents();
+    strokeBatcher->flush();
+    networkEngine->beginSnapshot(peer, appliedSequence);
+
+    CanvasState state = drawingArea->canvasState();
+    // The peer keeps the stroke it is still drawing across the reload, and
+    // the rest of it arrives here as usual.
+    state.tail.erase(std::remove_if(state.tail.begin(), state.tail.end(), [&state, peer](int i) {
+        const Stroke &stroke = state.strokes.stroke(i);
+        return stroke.owner == peer && !stroke.finished;
+    }), state.tail.end());
+    QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcher<QByteArray>::finished, this, [this, watcher, peer]() {
+        networkEngine->sendSnapshot(peer, watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run([state]() { return encodeCanvasSnapshot(state); }));
+}
+
+void GameWindow::captureKeyframe() {
+    strokeBatcher->flush();
+    recorder.beginKeyframe();
+
+    CanvasState state = drawingArea->canvasState();
+    int session = recordingSession;
+    QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcher<QByteArray>::finished, this, [this, watcher, session]() {
+        if (session == recordingSession) {
+            recorder.finishKeyframe(watcher->result());
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run([state]() { return encodeKeyframe(state); }));
 }
 
-void GameWindow::clientDisconnected() {
-    QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
-    if (!client) return;
-    clients.removeAll(client);
-    chatWidget->appendMessage("Player disconnected");
+static QString describePeerStats(const PeerStats &stats) {
+    QString rtt = stats.rttMicros < 0 ? QString("rtt -") : QString("rtt %1 ms, offset %2 ms")
+        .arg(stats.rttMicros / 1000.0, 0, 'f', 1)
+        .arg(stats.clockOffsetMicros / 1000.0, 0, 'f', 1);
+    return QString(" (%1, in %2 KB/s / %3 msgs, out %4 KB/s / %5 msgs, queue %6 KB, coalesced %7, thinned %8, discarded %9, duplicates %10)")
+        .arg(rtt)
+        .arg(stats.bytesInPerSecond / 1024.0, 0, 'f', 1)
+        .arg(stats.messagesIn)
+        .arg(stats.bytesOutPerSecond / 1024.0, 0, 'f', 1)
+        .arg(stats.messagesOut)
+        .arg(stats.queuedBytes / 1024)
+        .arg(stats.coalescedFrames)
+        .arg(stats.droppedSamples)
+        .arg(stats.discardedFrames)
+        .arg(stats.duplicateFrames);
+}
+
+// Each entry carries the player's stroke owner id; its check box shows or
+// hides that player's layer on this canvas only.
+void GameWindow::rebuildPlayerItems() {
+    QListWidgetItem *current = playerList->currentItem();
+    const int selected = current ? current->data(Qt::UserRole).toInt() : -1;
+    QSignalBlocker blocker(playerList);
     playerList->clear();
-    playerList->addItem("Player 1 (You)");
-    for (int i = 0; i < clients.size(); ++i) {
-        playerList->addItem("Player " + QString::number(i + 2));
+    auto addPlayer = [this, selected](const QString &text, int owner) {
+        QListWidgetItem *item = new QListWidgetItem(text, playerList);
+        item->setData(Qt::UserRole, owner);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(drawingArea->isPlayerVisible(quint16(owner)) ? Qt::Checked : Qt::Unchecked);
+        if (owner == selected) playerList->setCurrentItem(item);
+    };
+
+    addPlayer("Player 1 (You)", 0);
+    if (hosting) {
+        for (int i = 0; i < remotePlayers.size(); ++i) {
+            QString entry = "Player " + QString::number(i + 2);
+            if (peerStats.contains(remotePlayers[i])) {
+                entry += describePeerStats(peerStats[remotePlayers[i]]);
+            }
+            addPlayer(entry, remotePlayers[i]);
+        }
+    } else {
+        for (const PeerStats &stats : qAsConst(peerStats)) {
+            addPlayer("Host" + describePeerStats(stats), Protocol::HostPlayer);
+        }
+        for (quint16 owner : drawingArea->players()) {
+            if (owner != 0 && owner != Protocol::HostPlayer) {
+                addPlayer("Player " + QString::number(owner), owner);
+            }
+        }
     }
 }
 
-void GameWindow::broadcastMessage(const QString &message) {
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_5_15);
-    out << QString("message") << message;
-    for (QTcpSocket *client : clients) {
-        client->write(block);
-    }
+void GameWindow::onPlayerItemChanged(QListWidgetItem *item) {
+    drawingArea->setPlayerVisible(quint16(item->data(Qt::UserRole).toInt()), item->checkState() == Qt::Checked);
+}
+
+// Clearing is local, like hiding: other players keep their copy.
+void GameWindow::onClearPlayerClicked() {
+    QListWidgetItem *item = playerList->currentItem();
+    if (!item) return;
+    drawingArea->clearPlayer(quint16(item->data(Qt::UserRole).toInt()));
 }
 
-void GameWindow::broadcastPoint(const QPoint &point, int brushSize, const QColor &brushColor) {
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_5_15);
-    out << QString("point") << point << brushSize << brushColor;
-    for (QTcpSocket *client : clients) {
-        client->write(block);
+void GameWindow::refreshPlayerList() {
+    rebuildPlayerItems();
+
+    int measured = 0;
+    qint64 totalRtt = 0;
+    qint64 worstRtt = 0;
+    qint64 bytesIn = 0;
+    qint64 bytesOut = 0;
+    for (const PeerStats &stats : qAsConst(peerStats)) {
+        if (stats.rttMicros >= 0) {
+            ++measured;
+            totalRtt += stats.rttMicros;
+            worstRtt = qMax(worstRtt, stats.rttMicros);
+        }
+        bytesIn += stats.bytesInPerSecond;
+        bytesOut += stats.bytesOutPerSecond;
     }
+    roomStatsLabel->setText(QString("Room: %1 connections, rtt avg %2 ms, worst %3 ms, in %4 KB/s, out %5 KB/s")
+        .arg(peerStats.size())
+        .arg(measured ? totalRtt / 1000.0 / measured : 0.0, 0, 'f', 1)
+        .arg(worstRtt / 1000.0, 0, 'f', 1)
+        .arg(bytesIn / 1024.0, 0, 'f', 1)
+        .arg(bytesOut / 1024.0, 0, 'f', 1));
+}
+
+void GameWindow::broadcastFrame(const QByteArray &frame) {
+    recorder.recordFrame(0, frame);
+    networkEngine->send(frame);
+}
+
+void GameWindow::broadcastMessage(const QString &message) {
+    broadcastFrame(Protocol::encodeChat(message));
+}
+
+void GameWindow::onStrokeStarted(const QPoint &point, int brushSize, const QColor &brushColor) {
+    strokeBatcher->beginStroke(point, brushSize, brushColor.rgba());
 }
 
 void GameWindow::onPointDrawn(const QPoint &point, int brushSize, const QColor &brushColor) {
-    broadcastPoint(point, brushSize, brushColor);
+    Q_UNUSED(brushSize);
+    Q_UNUSED(brushColor);
+    strokeBatcher->addPoint(point);
+}
+
+void GameWindow::onStrokeFinished() {
+    strokeBatcher->endStroke();
 }
 
 void GameWindow::onSendMessage(const QString &message) {
@@ -396,6 +1282,255 @@ void GameWindow::onBrushColorChanged() {
     }
 }
 
+void GameWindow::onBatchIntervalChanged(int msec) {
+    strokeBatcher->setInterval(msec);
+}
+
+void GameWindow::onSimplifyToleranceChanged(double tolerance) {
+    drawingArea->setSimplifyTolerance(tolerance);
+    strokeBatcher->setSimplifyTolerance(tolerance);
+}
+
+void GameWindow::updateUploadRate() {
+    uploadRateLabel->setText(QString("Upload: %1 B/s").arg(qRound(strokeBatcher->bytesPerSecond())));
+}
+
+void GameWindow::onUndoClicked() {
+    if (drawingArea->undo()) {
+        strokeBatcher->flush();
+        broadcastFrame(Protocol::encodeUndo());
+    }
+}
+
+void GameWindow::onRedoClicked() {
+    if (drawingArea->redo()) {
+        strokeBatcher->flush();
+        broadcastFrame(Protocol::encodeRedo());
+    }
+}
+
+void GameWindow::onRecordToggled(bool checked) {
+    if (!checked) {
+        recorder.close();
+        recordButton->setText("Record");
+        return;
+    }
+    QString path = QFileDialog::getSaveFileName(this, "Save Recording", QString(), "Draw It recordings (*.drec)");
+    if (path.isEmpty() || !recorder.open(path)) {
+        recordButton->blockSignals(true);
+        recordButton->setChecked(false);
+        recordButton->blockSignals(false);
+        return;
+    }
+    ++recordingSession;
+    recordButton->setText("Stop Recording");
+    captureKeyframe();
+}
+
+void GameWindow::onRecordTick() {
+    if (recorder.keyframeDue()) {
+        captureKeyframe();
+    }
+    recorder.flush();
+}
+
+void GameWindow::onStatsToggled(bool checked) {
+    drawingArea->setOverlayVisible(checked);
+}
+
+void GameWindow::dumpMetrics() {
+    QString path = qEnvironmentVariable("DRAWIT_METRICS_FILE");
+    if (path.isEmpty()) {
+        path = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/metrics.json";
+    }
+    QJsonObject report = drawingArea->metrics().toJson();
+    report["strokeHistoryBytes"] = double(drawingArea->strokeStore().memoryUsage());
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Compact);
+    QtConcurrent::run([path, json]() {
+        QDir().mkpath(QFileInfo(path).absolutePath());
+        QSaveFile file(path);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(json);
+            file.commit();
+        }
+    });
+}
+
+ReplayWindow::ReplayWindow(const QString &path, QWidget *parent) : QDialog(parent), duration(0), playbackTime(0), playbackStart(0), nextRecord(SessionFormat::FileHeaderSize), playing(false) {
+    QHBoxLayout *mainLayout = new QHBoxLayout(this);
+
+    QVBoxLayout *leftLayout = new QVBoxLayout();
+    drawingArea = new DrawingArea(this);
+    drawingArea->setAttribute(Qt::WA_TransparentForMouseEvents);
+    leftLayout->addWidget(drawingArea);
+
+    QHBoxLayout *controlsLayout = new QHBoxLayout();
+    playPauseButton = new QPushButton("Play", this);
+    playPauseButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+    controlsLayout->addWidget(playPauseButton);
+
+    timeline = new QSlider(Qt::Horizontal, this);
+    controlsLayout->addWidget(timeline, 1);
+
+    timeLabel = new QLabel(this);
+    timeLabel->setStyleSheet("font-family: 'Roboto'; font-size: 14px; color: #333;");
+    controlsLayout->addWidget(timeLabel);
+    leftLayout->addLayout(controlsLayout);
+    mainLayout->addLayout(leftLayout, 3);
+
+    chatWidget = new ChatWidget(this);
+    chatWidget->setInputVisible(false);
+    mainLayout->addWidget(chatWidget, 1);
+
+    if (session.open(path)) {
+        duration = session.duration();
+    } else {
+        chatWidget->appendMessage("Could not open recording " + path);
+        playPauseButton->setEnabled(false);
+    }
+    timeline->setRange(0, int(qMin<qint64>(duration, std::numeric_limits<int>::max())));
+
+    connect(playPauseButton, &QPushButton::clicked, this, &ReplayWindow::onPlayPauseClicked);
+    connect(timeline, &QSlider::valueChanged, this, &ReplayWindow::onTimelineMoved);
+
+    playbackTimer = new QTimer(this);
+    connect(playbackTimer, &QTimer::timeout, this, &ReplayWindow::onTick);
+    playbackTimer->start(16);
+
+    seek(0);
+
+    setWindowTitle("Draw It - Replay");
+    setStyleSheet("background: qlineargradient(x1:0, y1:0, x2:1, y2:1, stop:0 #A1C4FD, stop:1 #C2E9FB);");
+    resize(1200, 800);
+}
+
+void ReplayWindow::onPlayPauseClicked() {
+    playing = !playing;
+    if (playing && playbackTime >= duration) {
+        seek(0);
+    }
+    playbackStart = playbackTime;
+    wallClock.start();
+    playPauseButton->setText(playing ? "Pause" : "Play");
+}
+
+void ReplayWindow::onTimelineMoved(int value) {
+    seek(value);
+    playbackStart = playbackTime;
+    wallClock.start();
+}
+
+void ReplayWindow::onTick() {
+    if (!playing) return;
+    advanceTo(qMin(duration, playbackStart + wallClock.elapsed()));
+    if (playbackTime >= duration) {
+        playing = false;
+        playPauseButton->setText("Play");
+    }
+}
+
+void ReplayWindow::seek(qint64 timestamp) {
+    drawingArea->clear();
+    chatWidget->clear();
+    replayPeers.clear();
+
+    nextRecord = session.keyframeOffset(timestamp);
+    qint64 offset = nextRecord;
+    SessionRecord record;
+    if (session.readRecord(&offset, &record) && record.type == SessionFormat::KeyframeRecord) {
+        loadKeyframe(record.payload);
+        nextRecord = offset;
+    }
+    advanceTo(timestamp);
+}
+
+void ReplayWindow::advanceTo(qint64 timestamp) {
+    qint64 offset = nextRecord;
+    SessionRecord record;
+    while (session.readRecord(&offset, &record) && record.timestamp <= timestamp) {
+        if (record.type == SessionFormat::FrameRecord) {
+            applyFrame(record.peer, record.payload);
+        }
+        nextRecord = offset;
+    }
+    playbackTime = timestamp;
+
+    timeline->blockSignals(true);
+    timeline->setValue(int(timestamp));
+    timeline->blockSignals(false);
+    timeLabel->setText(QString("%1 / %2").arg(formatTime(timestamp), formatTime(duration)));
+}
+
+void ReplayWindow::loadKeyframe(const QByteArray &keyframe) {
+    if (keyframe.size() < 4) return;
+    const char *data = keyframe.constData();
+    qint64 pngSize = qFromLittleEndian<quint32>(data);
+    if (pngSize > keyframe.size() - 4) return;
+    drawingArea->loadSnapshot(QImage::fromData(reinterpret_cast<const uchar*>(data + 4), int(pngSize), "PNG"));
+
+    int offset = 4 + int(pngSize);
+    while (keyframe.size() - offset >= 6) {
+        quint16 owner = qFromLittleEndian<quint16>(data + offset);
+        qint64 size = qFromLittleEndian<quint32>(data + offset + 2);
+        if (size > keyframe.size() - offset - 6) break;
+        applyFrame(owner, QByteArray::fromRawData(data + offset + 6, int(size)));
+        offset += 6 + int(size);
+    }
+}
+
+void ReplayWindow::applyFrame(quint16 peer, const QByteArray &frames) {
+    FrameReader reader;
+    reader.append(frames);
+    Protocol::Frame frame;
+    while (reader.readFrame(&frame)) {
+        ReplayPeer &state = replayPeers[peer];
+        switch (frame.opcode) {
+        case Protocol::Chat: {
+            QString message;
+            if (Protocol::decodeChat(frame.payload, &message)) {
+                chatWidget->appendMessage(message);
+            }
+            break;
+        }
+        case Protocol::StrokeBegin: {
+            Protocol::StrokeStart start;
+            if (!Protocol::decodeStrokeBegin(frame.payload, &start)) break;
+            if (state.stroke >= 0) drawingArea->endStroke(state.stroke);
+            state.stroke = drawingArea->beginStroke(start.point, start.brushSize, QColor::fromRgba(start.color), peer);
+            state.lastPoint = start.point;
+            break;
+        }
+        case Protocol::StrokePoints: {
+            QVector<QPoint> points;
+            if (state.stroke < 0 || !Protocol::decodeStrokePoints(frame.payload, state.lastPoint, &points) || points.isEmpty()) break;
+            for (const QPoint &point : points) {
+                drawingArea->extendStroke(state.stroke, point);
+            }
+            state.lastPoint = points.last();
+            break;
+        }
+        case Protocol::StrokeEnd:
+            if (state.stroke >= 0) drawingArea->endStroke(state.stroke);
+            state.stroke = -1;
+            break;
+        case Protocol::Undo:
+            drawingArea->undo(peer);
+            break;
+        case Protocol::Redo:
+            drawingArea->redo(peer);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+QString ReplayWindow::formatTime(qint64 msec) {
+    qint64 seconds = msec / 1000;
+    return QString("%1:%2:%3").arg(seconds / 3600).arg(seconds / 60 % 60, 2, 10, QChar('0')).arg(seconds % 60, 2, 10, QChar('0'));
+}
+
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     QFontDatabase fontDatabase;
     fontDatabase.addApplicationFont(":/fonts/Roboto-Regular.ttf");
@@ -442,6 +1577,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     joinLobbyButton = new QPushButton(centralWidget);
     joinLobbyButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
 
+    replayButton = new QPushButton(centralWidget);
+    replayButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 14px; border-radius: 5px; padding: 8px;");
+
     playButton = new QPushButton(centralWidget);
     playButton->setStyleSheet("background-color: #4A90E2; color: white; font-family: 'Roboto'; font-size: 16px; border-radius: 10px; padding: 10px;");
     playButton->setMinimumWidth(150);
@@ -495,6 +1633,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     friendButtonsLayout->addWidget(removeFriendButton);
     rightLayout->addLayout(friendButtonsLayout);
     rightLayout->addWidget(joinLobbyButton);
+    rightLayout->addWidget(replayButton);
     mainLayout->addLayout(rightLayout, 1);
 
     QVBoxLayout *outerLayout = new QVBoxLayout();
@@ -507,6 +1646,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     connect(addFriendButton, &QPushButton::clicked, this, &MainWindow::onAddFriendClicked);
     connect(removeFriendButton, &QPushButton::clicked, this, &MainWindow::onRemoveFriendClicked);
     connect(joinLobbyButton, &QPushButton::clicked, this, &MainWindow::onJoinLobbyClicked);
+    connect(replayButton, &QPushButton::clicked, this, &MainWindow::onReplayClicked);
     connect(languageCombo, QOverload<int>::of(&QComboBox::activated), this, &MainWindow::onLanguageChanged);
 
     translator = new QTranslator(this);
@@ -524,6 +1664,7 @@ void MainWindow::retranslateUi() {
     addFriendButton->setText(tr("Add Friend"));
     removeFriendButton->setText(tr("Remove"));
     joinLobbyButton->setText(tr("Join Lobby"));
+    replayButton->setText(tr("Watch Replay"));
 }
 
 void MainWindow::onPlayClicked() {
@@ -553,6 +1694,14 @@ void MainWindow::onJoinLobbyClicked() {
     joinDialog->exec();
 }
 
+void MainWindow::onReplayClicked() {
+    QString path = QFileDialog::getOpenFileName(this, tr("Open Recording"), QString(), tr("Draw It recordings (*.drec)"));
+    if (path.isEmpty()) return;
+    ReplayWindow *replayWindow = new ReplayWindow(path, this);
+    replayWindow->exec();
+    delete replayWindow;
+}
+
 void MainWindow::onLanguageChanged(int index) {
     QString lang = index == 0 ? "en" : "ru";
     translator->load("drawit_" + lang, "/Users/fuad/qt_projects/drawit/");
@@ -576,9 +1725,11 @@ void MainWindow::onRoomSettingsConfirmed(int maxPlayers) {
     GameWindow *gameWindow = new GameWindow(this, true);
     gameWindow->setMaxPlayers(maxPlayers);
     gameWindow->exec();
+    delete gameWindow;
 }
 
-void MainWindow::onJoinLobbyRequested(const QString &ip) {
-    GameWindow *gameWindow = new GameWindow(this, false, ip);
+void MainWindow::onJoinLobbyRequested(const QString &ip, quint32 room) {
+    GameWindow *gameWindow = new GameWindow(this, false, ip, room);
     gameWindow->exec();
+    delete gameWindow;
 }
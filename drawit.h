@@ -3,31 +3,81 @@
 
 #include <QMainWindow>
 #include <QWidget>
-#include <QTcpServer>
-#include <QTcpSocket>
 #include <QVector>
 #include <QPoint>
 #include <QSpinBox>
+#include <QDoubleSpinBox>
 #include <QLineEdit>
 #include <QComboBox>
 #include <QColor>
 #include <QDialog>
-#include <QTextEdit>
+#include <QStringList>
+#include <QImage>
+#include <QHash>
+#include <QPair>
+#include <QElapsedTimer>
+#include "strokestore.h"
+#include "tiledcanvas.h"
+#include "protocol.h"
+#include "strokebatcher.h"
+#include "networkengine.h"
+#include "sessionrecording.h"
+#include "metrics.h"
+#include "chatlog.h"
+#include "remoteplayback.h"
 
 class QPushButton;
 class QLabel;
 class QComboBox;
 class QListWidget;
-class QTextEdit;
+class QListWidgetItem;
+class QListView;
+class QThread;
+class QSlider;
+class QTimer;
+class QPainter;
+
+// What snapshots and keyframes are rendered from: the canvas as every peer
+// has it, so including whatever this side has hidden or cleared. Layer
+// bases come in stacking order; the tail is the strokes kept as vectors,
+// and redoable how many of each player's can be redone.
+struct CanvasState {
+    QImage base;
+    QVector<QPair<quint16, QImage>> layers;
+    StrokeStore strokes;
+    QVector<int> tail;
+    QHash<quint16, int> redoable;
+};
 
 class DrawingArea : public QWidget {
     Q_OBJECT
 public:
     explicit DrawingArea(QWidget *parent = nullptr);
-    void addPoint(const QPoint &point);
+    int beginStroke(const QPoint &point, int brushSize, const QColor &brushColor, quint16 owner = 0);
+    void extendStroke(int stroke, const QPoint &point);
+    void endStroke(int stroke);
+    bool undo(quint16 owner = 0);
+    bool redo(quint16 owner = 0);
     void clear();
     void setBrushSize(int size);
     void setBrushColor(const QColor &color);
+    void setSimplifyTolerance(double tolerance);
+    void setHistoryLimits(int maxPoints, int maxAgeSeconds);
+    const StrokeStore &strokeStore() const { return strokes; }
+    CanvasState canvasState() const;
+    QVector<int> strokesIn(const QRect &rect) const;
+    int strokeAt(const QPoint &point, int radius = 2) const;
+    void loadSnapshot(const QImage &image);
+    QVector<quint16> players() const { return tiles.layerOwners(); }
+    void setPlayerVisible(quint16 owner, bool visible);
+    bool isPlayerVisible(quint16 owner) const { return tiles.isLayerVisible(owner); }
+    void clearPlayer(quint16 owner);
+    void markRemoteSample(qint64 receivedAt);
+    void recordPlayoutDelay(qint64 delay);
+    void setOverlayVisible(bool visible);
+    bool isOverlayVisible() const { return overlayVisible; }
+    const ClientMetrics &metrics() const { return frameMetrics; }
+    static void paintStroke(QPainter *painter, const StrokeStore &store, int stroke);
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -36,15 +86,40 @@ protected:
     void mouseReleaseEvent(QMouseEvent *event) override;
 
 signals:
+    void strokeStarted(const QPoint &point, int brushSize, const QColor &brushColor);
     void pointDrawn(const QPoint &point, int brushSize, const QColor &brushColor);
+    void strokeFinished();
+    void strokesCompacted(const QVector<int> &discarded);
 
 private:
-    QVector<QPoint> points;
-    QVector<int> brushSizes;
-    QVector<QColor> brushColors;
-    bool drawing;
+    QVector<bool> undoableStrokes() const;
+    QVector<int> unbakedStrokes() const;
+    void bakeHistory();
+    void finishBaking(const QVector<int> &settled, const QHash<quint16, QImage> &bases, const QHash<quint16, QImage> &clearedBases);
+    QVector<int> discardableStrokes() const;
+    void compactHistory();
+    void simplifyStroke(int stroke);
+    void paintOverlay(QPainter *painter);
+
+    TiledCanvas tiles;
+    SpatialIndex index;
+    StrokeStore strokes;
+    QVector<qint64> finishTimes;
+    QHash<quint16, QVector<int>> undoHistory;
+    QHash<quint16, QVector<int>> redoHistory;
+    int localStroke;
     int currentBrushSize;
     QColor currentBrushColor;
+    double simplifyTolerance;
+    qint64 historyPointLimit;
+    qint64 historyAgeLimit;
+    int bakingStrokes;
+    quint32 canvasGeneration;
+    ClientMetrics frameMetrics;
+    qint64 pendingInputAt;
+    qint64 pendingRemoteAt;
+    bool overlayVisible;
+    QTimer *overlayTimer;
 };
 
 class RoomSettingsDialog : public QDialog {
@@ -64,20 +139,30 @@ private:
     QPushButton *confirmButton;
 };
 
+// Chat history plus the input line. Messages are queued and handed to the
+// capped log model at most once per frame, so a burst of relayed lines costs
+// one view update instead of one relayout per line.
 class ChatWidget : public QWidget {
     Q_OBJECT
 public:
     explicit ChatWidget(QWidget *parent = nullptr);
     void appendMessage(const QString &message);
+    void clear();
+    void setInputVisible(bool visible);
+    void setHistoryLimit(int messages);
 
 signals:
     void messageSent(const QString &message);
 
 private slots:
     void onSendMessage();
+    void flushMessages();
 
 private:
-    QTextEdit *chatDisplay;
+    QListView *chatView;
+    ChatLogModel *chatLog;
+    QStringList pendingMessages;
+    QTimer *flushTimer;
     QLineEdit *chatInput;
     QPushButton *sendButton;
 };
@@ -87,15 +172,17 @@ class JoinLobbyDialog : public QDialog {
 public:
     explicit JoinLobbyDialog(QWidget *parent = nullptr);
     QString getServerIp() const;
+    quint32 getRoomId() const;
 
 signals:
-    void joinRequested(const QString &ip);
+    void joinRequested(const QString &ip, quint32 room);
 
 private slots:
     void onJoinClicked();
 
 private:
     QLineEdit *serverIpInput;
+    QSpinBox *roomIdSpinBox;
     QPushButton *joinButton;
 };
 
@@ -120,33 +207,111 @@ private:
 class GameWindow : public QDialog {
     Q_OBJECT
 public:
-    explicit GameWindow(QWidget *parent = nullptr, bool isServer = false, const QString &serverIp = "");
+    explicit GameWindow(QWidget *parent = nullptr, bool isServer = false, const QString &serverIp = "", quint32 roomId = 0);
     ~GameWindow();
     void setMaxPlayers(int max);
 
 private slots:
+    void onStrokeStarted(const QPoint &point, int brushSize, const QColor &brushColor);
     void onPointDrawn(const QPoint &point, int brushSize, const QColor &brushColor);
-    void handleNewConnection();
-    void readClientData();
-    void clientDisconnected();
+    void onStrokeFinished();
+    void processNetworkEvents();
+    void releaseRemoteEvents();
     void onSendMessage(const QString &message);
     void onBrushSizeChanged(int index);
     void onBrushColorChanged();
+    void onBatchIntervalChanged(int msec);
+    void onSimplifyToleranceChanged(double tolerance);
+    void updateUploadRate();
+    void onUndoClicked();
+    void onRedoClicked();
+    void onRecordToggled(bool checked);
+    void onRecordTick();
+    void onStatsToggled(bool checked);
+    void onPlayerItemChanged(QListWidgetItem *item);
+    void onClearPlayerClicked();
+    void dumpMetrics();
 
 private:
-    void setupServer();
+    void handleNetworkEvent(const NetEvent &event);
+    void applyRemoteEvent(const NetEvent &event);
+    void flushRemoteEvents();
+    void sendSnapshot(int peer);
+    void captureKeyframe();
+    void refreshPlayerList();
+    void rebuildPlayerItems();
+    void broadcastFrame(const QByteArray &frame);
     void broadcastMessage(const QString &message);
-    void broadcastPoint(const QPoint &point, int brushSize, const QColor &brushColor);
 
-    QTcpServer *server;
-    QVector<QTcpSocket*> clients;
-    int maxPlayers;
+    bool hosting;
+    QThread *networkThread;
+    NetworkEngine *networkEngine;
+    QVector<int> remotePlayers;
+    QHash<int, int> remoteStrokes;
+    QHash<int, PeerStats> peerStats;
+    RemotePlayback remotePlayback;
+    QTimer *playbackTimer;
+    quint64 appliedSequence;
+    SessionRecorder recorder;
+    int recordingSession;
 
     DrawingArea *drawingArea;
     ChatWidget *chatWidget;
     QListWidget *playerList;
+    QPushButton *clearPlayerButton;
+    QLabel *roomStatsLabel;
     QComboBox *brushSizeCombo;
     QPushButton *brushColorButton;
+    QPushButton *undoButton;
+    QPushButton *redoButton;
+    QPushButton *recordButton;
+    QPushButton *statsButton;
+    QSpinBox *batchIntervalSpinBox;
+    QDoubleSpinBox *simplifySpinBox;
+    QLabel *uploadRateLabel;
+    StrokeBatcher *strokeBatcher;
+};
+
+// Plays a session recording back onto a read-only canvas. Seeking restarts
+// from the nearest keyframe at or before the target instead of replaying
+// the whole file.
+class ReplayWindow : public QDialog {
+    Q_OBJECT
+public:
+    explicit ReplayWindow(const QString &path, QWidget *parent = nullptr);
+
+private slots:
+    void onPlayPauseClicked();
+    void onTimelineMoved(int value);
+    void onTick();
+
+private:
+    struct ReplayPeer {
+        int stroke = -1;
+        QPoint lastPoint;
+    };
+
+    void seek(qint64 timestamp);
+    void advanceTo(qint64 timestamp);
+    void loadKeyframe(const QByteArray &keyframe);
+    void applyFrame(quint16 peer, const QByteArray &frames);
+    static QString formatTime(qint64 msec);
+
+    SessionReader session;
+    QHash<quint16, ReplayPeer> replayPeers;
+    qint64 duration;
+    qint64 playbackTime;
+    qint64 playbackStart;
+    qint64 nextRecord;
+    bool playing;
+    QElapsedTimer wallClock;
+
+    DrawingArea *drawingArea;
+    ChatWidget *chatWidget;
+    QPushButton *playPauseButton;
+    QSlider *timeline;
+    QLabel *timeLabel;
+    QTimer *playbackTimer;
 };
 
 class MainWindow : public QMainWindow {
@@ -159,11 +324,12 @@ private slots:
     void onAddFriendClicked();
     void onRemoveFriendClicked();
     void onJoinLobbyClicked();
+    void onReplayClicked();
     void onLanguageChanged(int index);
     void onCreateRoomRequested();
     void onJoinRoomRequested();
     void onRoomSettingsConfirmed(int maxPlayers);
-    void onJoinLobbyRequested(const QString &ip);
+    void onJoinLobbyRequested(const QString &ip, quint32 room);
 
 private:
     void retranslateUi();
@@ -178,6 +344,7 @@ private:
     QPushButton *addFriendButton;
     QPushButton *removeFriendButton;
     QPushButton *joinLobbyButton;
+    QPushButton *replayButton;
     QPushButton *playButton;
     QComboBox *languageCombo;
 };
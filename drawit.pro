@@ -1,4 +1,4 @@
-QT       += core gui widgets network
+QT       += core gui widgets network concurrent
 RESOURCES += mainmenu.qrc \
     photos.qrc
 
@@ -11,11 +11,36 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    chatlog.cpp \
+    remoteplayback.cpp \
     drawit.cpp \
-    main.cpp
+    lineraster.cpp \
+    main.cpp \
+    metrics.cpp \
+    networkengine.cpp \
+    polyline.cpp \
+    protocol.cpp \
+    sessionrecording.cpp \
+    spatialindex.cpp \
+    strokebatcher.cpp \
+    strokestore.cpp \
+    tiledcanvas.cpp
 
 HEADERS += \
-    drawit.h
+    chatlog.h \
+    remoteplayback.h \
+    drawit.h \
+    lineraster.h \
+    metrics.h \
+    networkengine.h \
+    polyline.h \
+    protocol.h \
+    sessionrecording.h \
+    spatialindex.h \
+    spscqueue.h \
+    strokebatcher.h \
+    strokestore.h \
+    tiledcanvas.h
 
 FORMS +=
 
@@ -0,0 +1,414 @@
+#include "lineraster.h"
+#include <QByteArray>
+#include <QRect>
+#include <QVector>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LINERASTER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// A segment relative to the region being rasterized. outer is the pen
+// radius plus the half pixel of antialiasing on either side of the edge.
+struct Segment {
+    float ax;
+    float ay;
+    float dx;
+    float dy;
+    float invLengthSquared;
+    float outer;
+};
+
+// Raises coverage[0..count) to the segment's coverage of the pixels starting
+// at column x; py is the row centre relative to the segment start.
+typedef void (*CoverageRow)(quint8 *coverage, int x, int count, float py, const Segment &segment);
+// Blends a premultiplied colour into count pixels scaled by their coverage.
+typedef void (*BlendRow)(quint32 *pixels, const quint8 *coverage, int count, quint32 color);
+
+struct Kernels {
+    CoverageRow coverage;
+    BlendRow blend;
+};
+
+// Every backend evaluates exactly this expression in the same order, so all
+// of them produce identical pixels.
+inline int coverageAt(float px, float py, const Segment &segment) {
+    float t = (px * segment.dx + py * segment.dy) * segment.invLengthSquared;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    float ex = px - t * segment.dx;
+    float ey = py - t * segment.dy;
+    float c = segment.outer - std::sqrt(ex * ex + ey * ey);
+    c = std::min(std::max(c, 0.0f), 1.0f);
+    return int(c * 255.0f + 0.5f);
+}
+
+inline quint32 div255(quint32 value) {
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+inline quint32 blendPixel(quint32 pixel, quint32 color, quint32 coverage) {
+    quint32 inverse = 255 - div255((color >> 24) * coverage);
+    quint32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        quint32 source = div255(((color >> shift) & 0xff) * coverage);
+        quint32 target = div255(((pixel >> shift) & 0xff) * inverse);
+        result |= (source + target) << shift;
+    }
+    return result;
+}
+
+void coverageRowScalar(quint8 *coverage, int x, int count, float py, const Segment &segment) {
+    for (int i = 0; i < count; ++i) {
+        float px = float(x + i) + 0.5f - segment.ax;
+        coverage[i] = quint8(std::max(int(coverage[i]), coverageAt(px, py, segment)));
+    }
+}
+
+void blendRowScalar(quint32 *pixels, const quint8 *coverage, int count, quint32 color) {
+    for (int i = 0; i < count; ++i) {
+        if (coverage[i]) pixels[i] = blendPixel(pixels[i], color, coverage[i]);
+    }
+}
+
+#ifdef LINERASTER_X86
+
+inline __m128i div255Sse2(__m128i value) {
+    value = _mm_add_epi16(value, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+}
+
+// Two pixels unpacked to 16 bits per channel, with the coverage repeated
+// across each pixel's four channels.
+inline __m128i blendSse2(__m128i pixels, __m128i color, __m128i coverage) {
+    __m128i source = div255Sse2(_mm_mullo_epi16(color, coverage));
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    return _mm_add_epi16(source, div255Sse2(_mm_mullo_epi16(pixels, inverse)));
+}
+
+void coverageRowSse2(quint8 *coverage, int x, int count, float py, const Segment &segment) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 steps = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 ax = _mm_set1_ps(segment.ax);
+    const __m128 dx = _mm_set1_ps(segment.dx);
+    const __m128 dy = _mm_set1_ps(segment.dy);
+    const __m128 invLengthSquared = _mm_set1_ps(segment.invLengthSquared);
+    const __m128 outer = _mm_set1_ps(segment.outer);
+    const __m128 row = _mm_set1_ps(py);
+    const __m128 rowDy = _mm_mul_ps(row, dy);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(float(x + i)), steps), half), ax);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(px, dx), rowDy), invLengthSquared);
+        t = _mm_min_ps(_mm_max_ps(t, zero), one);
+        __m128 ex = _mm_sub_ps(px, _mm_mul_ps(t, dx));
+        __m128 ey = _mm_sub_ps(row, _mm_mul_ps(t, dy));
+        __m128 c = _mm_sub_ps(outer, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey))));
+        c = _mm_min_ps(_mm_max_ps(c, zero), one);
+        __m128i value = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+        value = _mm_packus_epi16(_mm_packs_epi32(value, value), _mm_setzero_si128());
+        int packed;
+        std::memcpy(&packed, coverage + i, sizeof(packed));
+        packed = _mm_cvtsi128_si32(_mm_max_epu8(value, _mm_cvtsi32_si128(packed)));
+        std::memcpy(coverage + i, &packed, sizeof(packed));
+    }
+    coverageRowScalar(coverage + i, x + i, count - i, py, segment);
+}
+
+void blendRowSse2(quint32 *pixels, const quint8 *coverage, int count, quint32 color) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i source = _mm_unpacklo_epi8(_mm_set1_epi32(int(color)), zero);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int packed;
+        std::memcpy(&packed, coverage + i, sizeof(packed));
+        if (!packed) continue;
+        __m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+        c = _mm_unpacklo_epi16(c, c);
+        __m128i target = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+        __m128i low = blendSse2(_mm_unpacklo_epi8(target, zero), source, _mm_unpacklo_epi32(c, c));
+        __m128i high = blendSse2(_mm_unpackhi_epi8(target, zero), source, _mm_unpackhi_epi32(c, c));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), _mm_packus_epi16(low, high));
+    }
+    blendRowScalar(pixels + i, coverage + i, count - i, color);
+}
+
+TARGET_AVX2 inline __m256i div255Avx2(__m256i value) {
+    value = _mm256_add_epi16(value, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(value, _mm256_srli_epi16(value, 8)), 8);
+}
+
+TARGET_AVX2 inline __m256i blendAvx2(__m256i pixels, __m256i color, __m256i coverage) {
+    __m256i source = div255Avx2(_mm256_mullo_epi16(color, coverage));
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    return _mm256_add_epi16(source, div255Avx2(_mm256_mullo_epi16(pixels, inverse)));
+}
+
+TARGET_AVX2 void coverageRowAvx2(quint8 *coverage, int x, int count, float py, const Segment &segment) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 steps = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 ax = _mm256_set1_ps(segment.ax);
+    const __m256 dx = _mm256_set1_ps(segment.dx);
+    const __m256 dy = _mm256_set1_ps(segment.dy);
+    const __m256 invLengthSquared = _mm256_set1_ps(segment.invLengthSquared);
+    const __m256 outer = _mm256_set1_ps(segment.outer);
+    const __m256 row = _mm256_set1_ps(py);
+    const __m256 rowDy = _mm256_mul_ps(row, dy);
+    // Packing works within each 128-bit lane, so gather the low dword of
+    // both lanes to get the eight coverage bytes in order.
+    const __m256i gather = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(float(x + i)), steps), half), ax);
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(px, dx), rowDy), invLengthSquared);
+        t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+        __m256 ex = _mm256_sub_ps(px, _mm256_mul_ps(t, dx));
+        __m256 ey = _mm256_sub_ps(row, _mm256_mul_ps(t, dy));
+        __m256 c = _mm256_sub_ps(outer, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey))));
+        c = _mm256_min_ps(_mm256_max_ps(c, zero), one);
+        __m256i value = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, scale), half));
+        value = _mm256_packus_epi16(_mm256_packs_epi32(value, value), _mm256_setzero_si256());
+        __m128i bytes = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(value, gather));
+        __m128i *slot = reinterpret_cast<__m128i *>(coverage + i);
+        _mm_storel_epi64(slot, _mm_max_epu8(bytes, _mm_loadl_epi64(slot)));
+    }
+    // The tail runs legacy SSE code, which stalls on dirty upper halves.
+    _mm256_zeroupper();
+    coverageRowSse2(coverage + i, x + i, count - i, py, segment);
+}
+
+TARGET_AVX2 void blendRowAvx2(quint32 *pixels, const quint8 *coverage, int count, quint32 color) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i source = _mm256_unpacklo_epi8(_mm256_set1_epi32(int(color)), zero);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(coverage + i));
+        if (_mm_cvtsi128_si64(packed) == 0) continue;
+        // Each coverage byte widened to a dword holding it twice as 16-bit
+        // values, then doubled up to cover a pixel's four channels. The
+        // unpacks pair pixels the same way as the ones for the target.
+        __m256i c = _mm256_cvtepu8_epi32(packed);
+        c = _mm256_or_si256(c, _mm256_slli_epi32(c, 16));
+        __m256i target = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels + i));
+        __m256i low = blendAvx2(_mm256_unpacklo_epi8(target, zero), source, _mm256_unpacklo_epi32(c, c));
+        __m256i high = blendAvx2(_mm256_unpackhi_epi8(target, zero), source, _mm256_unpackhi_epi32(c, c));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), _mm256_packus_epi16(low, high));
+    }
+    _mm256_zeroupper();
+    blendRowSse2(pixels + i, coverage + i, count - i, color);
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const int osxsave = 1 << 27;
+    const int avx = 1 << 28;
+    if ((info[2] & (osxsave | avx)) != (osxsave | avx)) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+Kernels kernelsFor(LineRaster::Backend backend) {
+    switch (backend) {
+#ifdef LINERASTER_X86
+    case LineRaster::Avx2: return Kernels{coverageRowAvx2, blendRowAvx2};
+    case LineRaster::Sse2: return Kernels{coverageRowSse2, blendRowSse2};
+#endif
+    default: return Kernels{coverageRowScalar, blendRowScalar};
+    }
+}
+
+LineRaster::Backend bestBackend() {
+#ifdef LINERASTER_X86
+    return cpuHasAvx2() ? LineRaster::Avx2 : LineRaster::Sse2;
+#else
+    return LineRaster::Scalar;
+#endif
+}
+
+struct Dispatch {
+    std::atomic<int> backend;
+    std::atomic<bool> enabled;
+
+    Dispatch() : backend(bestBackend()), enabled(true) {
+        const QByteArray choice = qgetenv("DRAWIT_RASTER").toLower();
+        if (choice == "qpainter") {
+            enabled = false;
+        } else if (choice == "scalar") {
+            backend = LineRaster::Scalar;
+        } else if (choice == "sse2" && LineRaster::isSupported(LineRaster::Sse2)) {
+            backend = LineRaster::Sse2;
+        } else if (choice == "avx2" && LineRaster::isSupported(LineRaster::Avx2)) {
+            backend = LineRaster::Avx2;
+        }
+    }
+};
+
+Dispatch &dispatch() {
+    static Dispatch instance;
+    return instance;
+}
+
+// Rasterizes one segment's coverage into the region's buffer, visiting per
+// row only the columns the capsule can reach, and widens the row spans that
+// the blend pass has to cover.
+void stampSegment(quint8 *coverage, int *spans, const QSize &size, const QPoint &from, const QPoint &to, float outer, CoverageRow row) {
+    Segment segment;
+    segment.ax = float(from.x());
+    segment.ay = float(from.y());
+    segment.dx = float(to.x() - from.x());
+    segment.dy = float(to.y() - from.y());
+    float lengthSquared = segment.dx * segment.dx + segment.dy * segment.dy;
+    segment.invLengthSquared = lengthSquared > 0.0f ? 1.0f / lengthSquared : 0.0f;
+    segment.outer = outer;
+
+    const int top = std::max(0, int(std::floor(std::min(from.y(), to.y()) - outer)));
+    const int bottom = std::min(size.height() - 1, int(std::ceil(std::max(from.y(), to.y()) + outer)));
+    for (int y = top; y <= bottom; ++y) {
+        float centre = float(y) + 0.5f;
+        float t0 = 0.0f;
+        float t1 = 1.0f;
+        if (segment.dy != 0.0f) {
+            t0 = (centre - outer - segment.ay) / segment.dy;
+            t1 = (centre + outer - segment.ay) / segment.dy;
+            if (t0 > t1) std::swap(t0, t1);
+            if (t1 < 0.0f || t0 > 1.0f) continue;
+            t0 = std::max(t0, 0.0f);
+            t1 = std::min(t1, 1.0f);
+        }
+        float xa = segment.ax + t0 * segment.dx;
+        float xb = segment.ax + t1 * segment.dx;
+        int left = std::max(0, int(std::floor(std::min(xa, xb) - outer)));
+        int right = std::min(size.width() - 1, int(std::ceil(std::max(xa, xb) + outer)));
+        if (left > right) continue;
+        row(coverage + y * size.width() + left, left, right - left + 1, centre - segment.ay, segment);
+        spans[2 * y] = std::min(spans[2 * y], left);
+        spans[2 * y + 1] = std::max(spans[2 * y + 1], right);
+    }
+}
+
+}
+
+namespace LineRaster {
+
+void drawPolyline(QImage *image, const QPoint &origin, const StrokePoint *points, int count, int width, QRgb color) {
+    if (count <= 0 || qAlpha(color) == 0) return;
+    Q_ASSERT(image->format() == QImage::Format_ARGB32_Premultiplied);
+
+    const float outer = width / 2.0f + 0.5f;
+    const int reach = int(std::ceil(outer));
+    int left = INT_MAX, top = INT_MAX, right = INT_MIN, bottom = INT_MIN;
+    for (int i = 0; i < count; ++i) {
+        left = std::min(left, int(points[i].x));
+        top = std::min(top, int(points[i].y));
+        right = std::max(right, int(points[i].x));
+        bottom = std::max(bottom, int(points[i].y));
+    }
+    const QRect region = QRect(QPoint(left - reach, top - reach), QPoint(right + reach, bottom + reach))
+                             .translated(-origin).intersected(image->rect());
+    if (region.isEmpty()) return;
+
+    // Tiles are rebuilt on the thread pool, so each thread keeps its own
+    // scratch buffers instead of allocating them per stroke.
+    thread_local QVector<quint8> coverage;
+    thread_local QVector<int> spans;
+    coverage.fill(0, region.width() * region.height());
+    spans.resize(2 * region.height());
+    for (int y = 0; y < region.height(); ++y) {
+        spans[2 * y] = INT_MAX;
+        spans[2 * y + 1] = INT_MIN;
+    }
+
+    const Kernels kernels = kernelsFor(backend());
+    const QPoint offset = origin + region.topLeft();
+    const int segments = std::max(count - 1, 1);
+    for (int i = 0; i < segments; ++i) {
+        QPoint from = points[i].toPoint() - offset;
+        QPoint to = points[std::min(i + 1, count - 1)].toPoint() - offset;
+        stampSegment(coverage.data(), spans.data(), region.size(), from, to, outer, kernels.coverage);
+    }
+
+    const quint32 premultiplied = qPremultiply(color);
+    for (int y = 0; y < region.height(); ++y) {
+        int first = spans[2 * y];
+        int last = spans[2 * y + 1];
+        if (first > last) continue;
+        quint32 *pixels = reinterpret_cast<quint32 *>(image->scanLine(region.top() + y)) + region.left();
+        kernels.blend(pixels + first, coverage.constData() + y * region.width() + first, last - first + 1, premultiplied);
+    }
+}
+
+void drawSegment(QImage *image, const QPoint &origin, const QPoint &from, const QPoint &to, int width, QRgb color) {
+    const StrokePoint points[2] = {
+        {qint16(from.x()), qint16(from.y())},
+        {qint16(to.x()), qint16(to.y())}
+    };
+    drawPolyline(image, origin, points, 2, width, color);
+}
+
+bool isEnabled() {
+    return dispatch().enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled) {
+    dispatch().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+Backend backend() {
+    return Backend(dispatch().backend.load(std::memory_order_relaxed));
+}
+
+bool isSupported(Backend backend) {
+    switch (backend) {
+    case Scalar: return true;
+#ifdef LINERASTER_X86
+    case Sse2: return true;
+    case Avx2: return cpuHasAvx2();
+#endif
+    default: return false;
+    }
+}
+
+void setBackend(Backend backend) {
+    if (isSupported(backend)) dispatch().backend.store(backend, std::memory_order_relaxed);
+}
+
+const char *backendName(Backend backend) {
+    switch (backend) {
+    case Sse2: return "sse2";
+    case Avx2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+}
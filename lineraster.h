@@ -0,0 +1,40 @@
+#ifndef LINERASTER_H
+#define LINERASTER_H
+
+#include <QImage>
+#include <QPoint>
+#include "strokestore.h"
+
+namespace LineRaster {
+
+enum Backend {
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+// Stamps a round-capped, round-joined polyline of the given width straight
+// into a Format_ARGB32_Premultiplied image, where origin is the canvas
+// position of the image's top-left pixel. Coverage is the distance from each
+// pixel centre to the nearest segment with a one pixel antialiased rim, and
+// the polyline is blended once with its maximum coverage, so joints are not
+// darkened by overlapping segments. A single point draws a dot.
+void drawPolyline(QImage *image, const QPoint &origin, const StrokePoint *points, int count, int width, QRgb color);
+void drawSegment(QImage *image, const QPoint &origin, const QPoint &from, const QPoint &to, int width, QRgb color);
+
+// The kernels are picked once from what the CPU supports. DRAWIT_RASTER
+// can force "scalar", "sse2" or "avx2" (ignored if the CPU lacks it), or
+// "qpainter" to turn the rasterizer off so the canvas falls back to
+// QPainter. setEnabled() switches at run time so the benchmarks can
+// compare the two; switch it off only before strokes are cached, since
+// TiledCanvas builds a stroke's QPainterPath only while it is off.
+bool isEnabled();
+void setEnabled(bool enabled);
+Backend backend();
+bool isSupported(Backend backend);
+void setBackend(Backend backend);
+const char *backendName(Backend backend);
+
+}
+
+#endif
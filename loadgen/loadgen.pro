@@ -0,0 +1,27 @@
+QT       = core network
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = drawit-loadgen
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    loadgenerator.cpp \
+    ../polyline.cpp \
+    ../protocol.cpp \
+    ../sessionrecording.cpp \
+    ../strokebatcher.cpp
+
+HEADERS += \
+    loadgenerator.h \
+    ../polyline.h \
+    ../protocol.h \
+    ../sessionrecording.h \
+    ../strokebatcher.h
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,296 @@
+#include "loadgenerator.h"
+#include "sessionrecording.h"
+#include <QHash>
+#include <QHostAddress>
+#include <QSize>
+#include <QStringList>
+#include <algorithm>
+
+static const QString ProbePrefix = "[loadgen] ";
+// A stroke probe starts at this x, which no canvas point has, and carries
+// the low 32 bits of its send time in place of the colour.
+static const int StrokeProbeX = -32768;
+static const QSize CanvasSize(1000, 600);
+
+BotClient::BotClient(int id, LoadGenerator *generator, const QVector<ScriptedFrame> *script) : QObject(generator), id(id), generator(generator), script(script), roomId(0), random(quint32(id) + 1), connected(false), drawing(false), strokeProbePending(false), strokeStart(0), strokeLength(0), nextStroke(0), lastSample(0), scriptIndex(0), scriptOrigin(0), probeSequence(0), frameSequence(0) {
+    connect(&socket, &QTcpSocket::connected, this, &BotClient::onConnected);
+    connect(&socket, &QTcpSocket::readyRead, this, &BotClient::onReadyRead);
+    connect(&socket, &QTcpSocket::disconnected, this, &BotClient::onDisconnected);
+    connect(&socket, &QTcpSocket::errorOccurred, this, [this]() {
+        if (!connected) generator->recordDisconnect();
+    });
+    connect(&batcher, &StrokeBatcher::frameReady, this, &BotClient::sendFrame);
+}
+
+void BotClient::start(quint16 port, quint32 room, int batchInterval) {
+    roomId = room;
+    batcher.setInterval(batchInterval);
+    socket.connectToHost(QHostAddress::LocalHost, port);
+}
+
+void BotClient::onConnected() {
+    connected = true;
+    socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    sendFrame(Protocol::encodeHello(roomId));
+    qint64 now = generator->now();
+    nextStroke = now + random.bounded(1000) * 1000;
+    scriptOrigin = now;
+}
+
+void BotClient::onDisconnected() {
+    if (connected) {
+        connected = false;
+        generator->recordDisconnect();
+    }
+}
+
+void BotClient::sendFrame(const QByteArray &frame) {
+    if (socket.state() != QAbstractSocket::ConnectedState) return;
+    QByteArray stamped = frame;
+    if (Protocol::isRelayedOpcode(quint8(stamped[0]))) {
+        Protocol::stampFrame(&stamped, 0, 0, ++frameSequence);
+    }
+    socket.write(stamped);
+    generator->recordSent(frame.size());
+}
+
+void BotClient::onReadyRead() {
+    reader.append(socket.readAll());
+    Protocol::Frame frame;
+    while (reader.readFrame(&frame)) {
+        generator->recordReceived(Protocol::HeaderSize + frame.payload.size());
+        qint64 time = 0;
+        if (frame.opcode == Protocol::Ping && Protocol::decodePing(frame.payload, &time)) {
+            sendFrame(Protocol::encodePong(time, generator->now()));
+            continue;
+        }
+        QString message;
+        if (frame.opcode == Protocol::Chat && Protocol::decodeChat(frame.payload, &message) && message.startsWith(ProbePrefix)) {
+            const QStringList fields = message.mid(ProbePrefix.size()).split(' ');
+            if (fields.size() == 3) {
+                generator->recordChatLatency(generator->now() - fields[2].toLongLong());
+            }
+            continue;
+        }
+        Protocol::StrokeStart start;
+        if (frame.opcode == Protocol::StrokeBegin && Protocol::decodeStrokeBegin(frame.payload, &start) && start.point.x() == StrokeProbeX) {
+            generator->recordStrokeLatency(qint64(quint32(generator->now()) - start.color));
+        }
+    }
+}
+
+// The stroke probe waits for the bot to lift its pen, since a StrokeBegin
+// in the middle of a stroke would end it for everyone else.
+void BotClient::sendProbe(qint64 now) {
+    if (!connected) return;
+    sendFrame(Protocol::encodeChat(ProbePrefix + QString("%1 %2 %3").arg(id).arg(++probeSequence).arg(now)));
+    strokeProbePending = true;
+}
+
+void BotClient::sendStrokeProbe(qint64 now) {
+    strokeProbePending = false;
+    batcher.beginStroke(QPoint(StrokeProbeX, 0), 1, quint32(now));
+    batcher.endStroke();
+}
+
+void BotClient::planStroke(qint64 now) {
+    for (QPointF &point : curve) {
+        point = QPointF(random.bounded(CanvasSize.width()), random.bounded(CanvasSize.height()));
+    }
+    strokeStart = now;
+    strokeLength = (500 + random.bounded(1500)) * 1000;
+    drawing = true;
+    static const int BrushSizes[] = {2, 5, 10};
+    batcher.beginStroke(samplePoint(0), BrushSizes[random.bounded(3)], 0xff000000 | random.generate());
+}
+
+QPoint BotClient::samplePoint(double t) {
+    double u = 1 - t;
+    QPointF point = u * u * u * curve[0] + 3 * u * u * t * curve[1] + 3 * u * t * t * curve[2] + t * t * t * curve[3];
+    return QPoint(qRound(point.x() + random.bounded(2.0) - 1), qRound(point.y() + random.bounded(2.0) - 1));
+}
+
+void BotClient::tick(qint64 now) {
+    if (!connected) return;
+
+    if (strokeProbePending && !drawing) sendStrokeProbe(now);
+
+    if (script) {
+        if (script->isEmpty()) return;
+        while (scriptIndex < script->size() && script->at(scriptIndex).timestamp * 1000 <= now - scriptOrigin) {
+            const QByteArray &frame = script->at(scriptIndex++).frame;
+            if (quint8(frame[0]) == Protocol::StrokeBegin) drawing = true;
+            if (quint8(frame[0]) == Protocol::StrokeEnd) drawing = false;
+            sendFrame(frame);
+        }
+        if (scriptIndex == script->size()) {
+            scriptIndex = 0;
+            scriptOrigin = now;
+        }
+        return;
+    }
+
+    if (!drawing) {
+        if (now >= nextStroke) planStroke(now);
+        return;
+    }
+    double t = double(now - strokeStart) / double(strokeLength);
+    if (t >= 1) {
+        batcher.addPoint(samplePoint(1));
+        batcher.endStroke();
+        drawing = false;
+        nextStroke = now + (200 + random.bounded(800)) * 1000;
+    } else {
+        batcher.addPoint(samplePoint(t));
+    }
+}
+
+LoadGenerator::LoadGenerator(const LoadSettings &settings, QObject *parent) : QObject(parent), settings(settings), nextProbe(0), startedBots(0), sentFrames(0), sentBytes(0), receivedFrames(0), receivedBytes(0), intervalSentBytes(0), intervalReceivedBytes(0), disconnects(0) {
+    connect(&rampTimer, &QTimer::timeout, this, &LoadGenerator::connectNext);
+    connect(&sampleTimer, &QTimer::timeout, this, &LoadGenerator::tick);
+    connect(&reportTimer, &QTimer::timeout, this, &LoadGenerator::report);
+}
+
+bool LoadGenerator::start() {
+    if (!settings.recording.isEmpty() && !loadRecording()) {
+        qCritical("Could not load stroke frames from %s", qPrintable(settings.recording));
+        return false;
+    }
+    for (int i = 0; i < settings.clients; ++i) {
+        bots.append(new BotClient(i + 1, this, scripts.isEmpty() ? nullptr : &scripts[i % scripts.size()]));
+    }
+
+    clock.start();
+    nextProbe = qint64(settings.chatInterval) * 1000;
+    rampTimer.start(settings.rampInterval);
+    sampleTimer.setTimerType(Qt::PreciseTimer);
+    sampleTimer.start(qMax(1, 1000 / qMax(1, settings.sampleRate)));
+    reportTimer.start(1000);
+    connectNext();
+
+    QTimer::singleShot(settings.duration * 1000, this, [this]() {
+        sampleTimer.stop();
+        reportTimer.stop();
+        rampTimer.stop();
+        printSummary();
+        emit finished();
+    });
+    return true;
+}
+
+bool LoadGenerator::loadRecording() {
+    SessionReader reader;
+    if (!reader.open(settings.recording)) return false;
+
+    QHash<quint16, int> scriptForPeer;
+    qint64 offset = SessionFormat::FileHeaderSize;
+    SessionRecord record;
+    while (reader.readRecord(&offset, &record)) {
+        if (record.type != SessionFormat::FrameRecord || record.payload.isEmpty()) continue;
+        if (!Protocol::isCanvasOpcode(quint8(record.payload[0]))) continue;
+        if (!scriptForPeer.contains(record.peer)) {
+            scriptForPeer.insert(record.peer, scripts.size());
+            scripts.append(QVector<ScriptedFrame>());
+        }
+        QVector<ScriptedFrame> &script = scripts[scriptForPeer.value(record.peer)];
+        ScriptedFrame frame;
+        frame.timestamp = record.timestamp;
+        frame.frame = QByteArray(record.payload.constData(), record.payload.size());
+        script.append(frame);
+    }
+    for (QVector<ScriptedFrame> &script : scripts) {
+        qint64 origin = script.first().timestamp;
+        for (ScriptedFrame &frame : script) {
+            frame.timestamp -= origin;
+        }
+    }
+    return !scripts.isEmpty();
+}
+
+void LoadGenerator::connectNext() {
+    if (startedBots == bots.size()) {
+        rampTimer.stop();
+        return;
+    }
+    bots[startedBots++]->start(settings.port, settings.room, settings.batchInterval);
+}
+
+void LoadGenerator::tick() {
+    qint64 time = now();
+    for (BotClient *bot : bots) {
+        bot->tick(time);
+    }
+    if (settings.chatInterval > 0 && time >= nextProbe) {
+        for (BotClient *bot : bots) {
+            bot->sendProbe(time);
+        }
+        nextProbe = time + qint64(settings.chatInterval) * 1000;
+    }
+}
+
+void LoadGenerator::recordSent(qint64 bytes) {
+    ++sentFrames;
+    sentBytes += bytes;
+    intervalSentBytes += bytes;
+}
+
+void LoadGenerator::recordReceived(qint64 bytes) {
+    ++receivedFrames;
+    receivedBytes += bytes;
+    intervalReceivedBytes += bytes;
+}
+
+void LoadGenerator::recordChatLatency(qint64 usec) {
+    chatLatencies.append(usec);
+    intervalChatLatencies.append(usec);
+}
+
+void LoadGenerator::recordStrokeLatency(qint64 usec) {
+    strokeLatencies.append(usec);
+    intervalStrokeLatencies.append(usec);
+}
+
+void LoadGenerator::recordDisconnect() {
+    ++disconnects;
+}
+
+qint64 LoadGenerator::percentile(QVector<qint64> samples, double fraction) {
+    if (samples.isEmpty()) return 0;
+    int index = qMin(samples.size() - 1, int(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+void LoadGenerator::report() {
+    int connected = 0;
+    for (BotClient *bot : bots) {
+        if (bot->isConnected()) ++connected;
+    }
+    qInfo("%4llds  clients %d/%d  sent %.1f KB/s  received %.1f KB/s  disconnects %d  stroke p50 %.2f ms p99 %.2f ms  chat p50 %.2f ms p99 %.2f ms",
+          clock.elapsed() / 1000, connected, int(bots.size()),
+          intervalSentBytes / 1024.0, intervalReceivedBytes / 1024.0, disconnects,
+          percentile(intervalStrokeLatencies, 0.5) / 1000.0, percentile(intervalStrokeLatencies, 0.99) / 1000.0,
+          percentile(intervalChatLatencies, 0.5) / 1000.0, percentile(intervalChatLatencies, 0.99) / 1000.0);
+    intervalSentBytes = 0;
+    intervalReceivedBytes = 0;
+    intervalChatLatencies.clear();
+    intervalStrokeLatencies.clear();
+}
+
+void LoadGenerator::printLatency(const char *lane, const QVector<qint64> &samples) {
+    qInfo("  %s latency over %d samples: p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  p99.9 %.2f ms  max %.2f ms",
+          lane, int(samples.size()),
+          percentile(samples, 0.5) / 1000.0, percentile(samples, 0.9) / 1000.0,
+          percentile(samples, 0.99) / 1000.0, percentile(samples, 0.999) / 1000.0,
+          percentile(samples, 1.0) / 1000.0);
+}
+
+void LoadGenerator::printSummary() {
+    double seconds = qMax<qint64>(1, clock.elapsed()) / 1000.0;
+    qInfo("Summary over %.1f s with %d clients", seconds, int(bots.size()));
+    qInfo("  sent      %lld frames, %.1f frames/s, %.1f KB/s", sentFrames, sentFrames / seconds, sentBytes / 1024.0 / seconds);
+    qInfo("  received  %lld frames, %.1f frames/s, %.1f KB/s", receivedFrames, receivedFrames / seconds, receivedBytes / 1024.0 / seconds);
+    qInfo("  disconnects and failed connects: %d", disconnects);
+    printLatency("stroke", strokeLatencies);
+    printLatency("chat  ", chatLatencies);
+}
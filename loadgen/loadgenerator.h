@@ -0,0 +1,137 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QVector>
+#include <QPointF>
+#include "protocol.h"
+#include "strokebatcher.h"
+
+struct LoadSettings {
+    quint16 port = Protocol::DefaultPort;
+    quint32 room = 0;
+    int clients = 8;
+    int sampleRate = 120;
+    int batchInterval = 16;
+    int chatInterval = 1000;
+    int rampInterval = 50;
+    int duration = 30;
+    QString recording;
+};
+
+struct ScriptedFrame {
+    qint64 timestamp = 0;
+    QByteArray frame;
+};
+
+class LoadGenerator;
+
+// One synthetic player. It speaks the same protocol as GameWindow: Hello,
+// then batched stroke frames and chat. Strokes are either smooth random
+// Bezier curves sampled at the configured rate or the stroke frames of one
+// player from a session recording, replayed with their original timing.
+class BotClient : public QObject {
+    Q_OBJECT
+public:
+    BotClient(int id, LoadGenerator *generator, const QVector<ScriptedFrame> *script);
+    void start(quint16 port, quint32 room, int batchInterval);
+    void tick(qint64 now);
+    void sendProbe(qint64 now);
+    bool isConnected() const { return connected; }
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onDisconnected();
+    void sendFrame(const QByteArray &frame);
+
+private:
+    void planStroke(qint64 now);
+    void sendStrokeProbe(qint64 now);
+    QPoint samplePoint(double t);
+
+    int id;
+    LoadGenerator *generator;
+    const QVector<ScriptedFrame> *script;
+    quint32 roomId;
+    QTcpSocket socket;
+    FrameReader reader;
+    StrokeBatcher batcher;
+    QRandomGenerator random;
+    bool connected;
+    bool drawing;
+    bool strokeProbePending;
+    qint64 strokeStart;
+    qint64 strokeLength;
+    qint64 nextStroke;
+    qint64 lastSample;
+    QPointF curve[4];
+    int scriptIndex;
+    qint64 scriptOrigin;
+    quint32 probeSequence;
+    quint32 frameSequence;
+};
+
+// Opens the bot connections against a host on localhost, drives them from a
+// shared sample clock and prints throughput, disconnects and relay latency
+// once per second plus a percentile summary at the end. Latency is measured
+// with probes carrying the send time, on each lane separately since the
+// host lets chat overtake strokes: a chat line, and a one-sample stroke
+// drawn off the canvas between two of the bot's own strokes. All bots share
+// one process clock, so every bot that receives a probe contributes a
+// sample.
+class LoadGenerator : public QObject {
+    Q_OBJECT
+public:
+    explicit LoadGenerator(const LoadSettings &settings, QObject *parent = nullptr);
+    bool start();
+
+    qint64 now() const { return clock.nsecsElapsed() / 1000; }
+    void recordSent(qint64 bytes);
+    void recordReceived(qint64 bytes);
+    void recordChatLatency(qint64 usec);
+    void recordStrokeLatency(qint64 usec);
+    void recordDisconnect();
+
+signals:
+    void finished();
+
+private slots:
+    void connectNext();
+    void tick();
+    void report();
+
+private:
+    bool loadRecording();
+    void printSummary();
+    static qint64 percentile(QVector<qint64> samples, double fraction);
+    static void printLatency(const char *lane, const QVector<qint64> &samples);
+
+    LoadSettings settings;
+    QVector<BotClient*> bots;
+    QVector<QVector<ScriptedFrame>> scripts;
+    QElapsedTimer clock;
+    QTimer sampleTimer;
+    QTimer reportTimer;
+    QTimer rampTimer;
+    qint64 nextProbe;
+    int startedBots;
+
+    qint64 sentFrames;
+    qint64 sentBytes;
+    qint64 receivedFrames;
+    qint64 receivedBytes;
+    qint64 intervalSentBytes;
+    qint64 intervalReceivedBytes;
+    int disconnects;
+    QVector<qint64> chatLatencies;
+    QVector<qint64> strokeLatencies;
+    QVector<qint64> intervalChatLatencies;
+    QVector<qint64> intervalStrokeLatencies;
+};
+
+#endif
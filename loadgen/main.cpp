@@ -0,0 +1,39 @@
+#include "loadgenerator.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("drawit-loadgen");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless bot players that stress a Draw It host on localhost.");
+    parser.addHelpOption();
+    QCommandLineOption portOption({"p", "port"}, "Host port on localhost.", "port", QString::number(Protocol::DefaultPort));
+    QCommandLineOption roomOption({"r", "room"}, "Room ID to join (dedicated relays only).", "room", "0");
+    QCommandLineOption clientsOption({"c", "clients"}, "Number of bot connections.", "count", "8");
+    QCommandLineOption rateOption({"s", "sample-rate"}, "Stroke samples per second per bot.", "hz", "120");
+    QCommandLineOption batchOption({"b", "batch"}, "Stroke batching interval in milliseconds.", "ms", "16");
+    QCommandLineOption chatOption("chat-interval", "Milliseconds between latency probes, one chat line and one stroke, per bot (0 disables).", "ms", "1000");
+    QCommandLineOption rampOption("ramp", "Milliseconds between opening connections.", "ms", "50");
+    QCommandLineOption durationOption({"d", "duration"}, "Test length in seconds.", "seconds", "30");
+    QCommandLineOption recordingOption("recording", "Replay stroke frames from a session recording instead of generating curves.", "file");
+    parser.addOptions({portOption, roomOption, clientsOption, rateOption, batchOption, chatOption, rampOption, durationOption, recordingOption});
+    parser.process(a);
+
+    LoadSettings settings;
+    settings.port = quint16(parser.value(portOption).toUInt());
+    settings.room = parser.value(roomOption).toUInt();
+    settings.clients = qMax(1, parser.value(clientsOption).toInt());
+    settings.sampleRate = qMax(1, parser.value(rateOption).toInt());
+    settings.batchInterval = qMax(0, parser.value(batchOption).toInt());
+    settings.chatInterval = qMax(0, parser.value(chatOption).toInt());
+    settings.rampInterval = qMax(0, parser.value(rampOption).toInt());
+    settings.duration = qMax(1, parser.value(durationOption).toInt());
+    settings.recording = parser.value(recordingOption);
+
+    LoadGenerator generator(settings);
+    QObject::connect(&generator, &LoadGenerator::finished, &a, &QCoreApplication::quit);
+    if (!generator.start()) return 1;
+    return a.exec();
+}
@@ -0,0 +1,90 @@
+#include "metrics.h"
+#include <QJsonArray>
+#include <QtAlgorithms>
+#include <chrono>
+
+Histogram::Histogram() {
+    reset();
+}
+
+int Histogram::bucketFor(quint64 value) {
+    if (value < SubBuckets) return int(value);
+    int octave = 63 - qCountLeadingZeroBits(value);
+    int bucket = (octave - 2) * SubBuckets + int((value >> (octave - 3)) & (SubBuckets - 1));
+    return qMin(bucket, BucketCount - 1);
+}
+
+quint64 Histogram::bucketValue(int bucket) {
+    if (bucket < SubBuckets) return quint64(bucket);
+    int octave = bucket / SubBuckets + 2;
+    quint64 width = quint64(1) << (octave - 3);
+    return (quint64(SubBuckets + bucket % SubBuckets) << (octave - 3)) + width / 2;
+}
+
+void Histogram::record(quint64 value) {
+    buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    quint64 current = largest.load(std::memory_order_relaxed);
+    while (value > current && !largest.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::reset() {
+    for (std::atomic<quint64> &bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    largest.store(0, std::memory_order_relaxed);
+}
+
+double Histogram::mean() const {
+    quint64 samples = count();
+    return samples ? double(sum.load(std::memory_order_relaxed)) / double(samples) : 0.0;
+}
+
+quint64 Histogram::percentile(double fraction) const {
+    quint64 samples = count();
+    if (samples == 0) return 0;
+    quint64 rank = qMax<quint64>(1, quint64(fraction * double(samples) + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return qMin(bucketValue(i), maximum());
+    }
+    return maximum();
+}
+
+QJsonObject Histogram::toJson() const {
+    QJsonArray counts;
+    for (int i = 0; i < BucketCount; ++i) {
+        quint64 bucketCount = buckets[i].load(std::memory_order_relaxed);
+        if (bucketCount > 0) {
+            counts.append(QJsonArray{double(bucketValue(i)), double(bucketCount)});
+        }
+    }
+    QJsonObject object;
+    object["count"] = double(count());
+    object["mean"] = mean();
+    object["p50"] = double(percentile(0.5));
+    object["p90"] = double(percentile(0.9));
+    object["p99"] = double(percentile(0.99));
+    object["max"] = double(maximum());
+    object["buckets"] = counts;
+    return object;
+}
+
+qint64 ClientMetrics::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+QJsonObject ClientMetrics::toJson() const {
+    QJsonObject object;
+    object["paintTimeUs"] = paintTime.toJson();
+    object["segmentsPerFrame"] = segmentsPerFrame.toJson();
+    object["inputToPixelUs"] = inputToPixel.toJson();
+    object["networkToPixelUs"] = networkToPixel.toJson();
+    object["playoutDelayUs"] = playoutDelay.toJson();
+    return object;
+}
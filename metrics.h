@@ -0,0 +1,48 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QJsonObject>
+#include <atomic>
+
+// Fixed-size log-linear histogram: each power of two is split into eight
+// buckets, so percentiles are within ~6% of the true value. Recording is a
+// couple of relaxed atomic adds, so any thread can record or read without
+// taking a lock.
+class Histogram {
+public:
+    static const int SubBuckets = 8;
+    static const int BucketCount = 30 * SubBuckets;
+
+    Histogram();
+    void record(quint64 value);
+    void reset();
+    quint64 count() const { return total.load(std::memory_order_relaxed); }
+    quint64 maximum() const { return largest.load(std::memory_order_relaxed); }
+    double mean() const;
+    quint64 percentile(double fraction) const;
+    QJsonObject toJson() const;
+
+private:
+    static int bucketFor(quint64 value);
+    static quint64 bucketValue(int bucket);
+
+    std::atomic<quint64> buckets[BucketCount];
+    std::atomic<quint64> total;
+    std::atomic<quint64> sum;
+    std::atomic<quint64> largest;
+};
+
+// Client-side frame timings. Durations are in microseconds on the
+// now() clock, which is monotonic and shared by all threads.
+struct ClientMetrics {
+    Histogram paintTime;
+    Histogram segmentsPerFrame;
+    Histogram inputToPixel;
+    Histogram networkToPixel;
+    Histogram playoutDelay;
+
+    static qint64 now();
+    QJsonObject toJson() const;
+};
+
+#endif
@@ -0,0 +1,682 @@
+#include "networkengine.h"
+#include <QTimer>
+#include <QMetaObject>
+#include <QtEndian>
+
+NetworkEngine::NetworkEngine(QObject *parent) : QObject(parent), server(nullptr), nextPeerId(1), roomId(0), localPlayer(0), nextSequence(1), localSequence(0), readAt(0), maxPlayers(2), drainScheduled(false) {
+    backlogTimer = new QTimer(this);
+    backlogTimer->setInterval(16);
+    connect(backlogTimer, &QTimer::timeout, this, &NetworkEngine::flushEvents);
+
+    statsTimer = new QTimer(this);
+    statsTimer->setInterval(1000);
+    connect(statsTimer, &QTimer::timeout, this, &NetworkEngine::publishStats);
+}
+
+static const int MaxSnapshotSize = 64 * 1024 * 1024;
+static const qint64 WriteBudget = 64 * 1024;
+static const int SnapshotChunk = WriteBudget / 4;
+static const qint64 HighWaterMark = 256 * 1024;
+static const qint64 LowWaterMark = HighWaterMark / 2;
+static const int StallTimeoutMs = 10000;
+static const int CoalesceTolerance = 3;
+static const int MaxCoalescedPoints = 8192;
+static const int ClockSampleWindow = 8;
+
+static int countFrames(const QByteArray &frames) {
+    int count = 0;
+    for (int offset = 0; frames.size() - offset >= Protocol::HeaderSize; ++count) {
+        offset += Protocol::HeaderSize + (quint8(frames[offset + 1]) | (quint8(frames[offset + 2]) << 8));
+    }
+    return count;
+}
+
+static QVector<QByteArray> splitFrames(const QByteArray &frames) {
+    QVector<QByteArray> split;
+    for (int offset = 0; frames.size() - offset >= Protocol::HeaderSize;) {
+        int size = Protocol::HeaderSize + (quint8(frames[offset + 1]) | (quint8(frames[offset + 2]) << 8));
+        split.append(frames.mid(offset, size));
+        offset += size;
+    }
+    return split;
+}
+
+static bool readSingleFrame(const QByteArray &data, Protocol::Frame *frame) {
+    if (data.size() < Protocol::HeaderSize) return false;
+    int length = quint8(data[1]) | (quint8(data[2]) << 8);
+    if (data.size() != Protocol::HeaderSize + length) return false;
+    frame->opcode = quint8(data[0]);
+    frame->origin = qFromLittleEndian<quint16>(data.constData() + 3);
+    frame->sequence = qFromLittleEndian<quint32>(data.constData() + 5);
+    frame->payload = data.mid(Protocol::HeaderSize);
+    return true;
+}
+
+static void advanceStrokePoints(const QByteArray &frames, QHash<quint16, QPoint> *lastPoints) {
+    FrameReader reader;
+    reader.append(frames);
+    Protocol::Frame frame;
+    while (reader.readFrame(&frame)) {
+        if (!Protocol::isCanvasOpcode(frame.opcode)) continue;
+        QPoint &point = (*lastPoints)[frame.origin];
+        Protocol::StrokeStart start;
+        QPoint single;
+        QVector<QPoint> points;
+        if (frame.opcode == Protocol::StrokeBegin && Protocol::decodeStrokeBegin(frame.payload, &start)) {
+            point = start.point;
+        } else if (frame.opcode == Protocol::StrokePoint && Protocol::decodeStrokePoint(frame.payload, &single)) {
+            point = single;
+        } else if (frame.opcode == Protocol::StrokePoints && Protocol::decodeStrokePoints(frame.payload, point, &points) && !points.isEmpty()) {
+            point = points.last();
+        }
+    }
+}
+
+static QVector<QPoint> thinPoints(const QVector<QPoint> &points, int tolerance) {
+    QVector<QPoint> kept;
+    QPoint last;
+    for (int i = 0; i < points.size(); ++i) {
+        QPoint delta = points[i] - last;
+        bool final = i == points.size() - 1;
+        if (kept.isEmpty() || final || delta.x() * delta.x() + delta.y() * delta.y() >= tolerance * tolerance) {
+            kept.append(points[i]);
+            last = points[i];
+        }
+    }
+    return kept;
+}
+
+void NetworkEngine::send(const QByteArray &frame) {
+    NetCommand command;
+    command.data = frame;
+    submit(std::move(command));
+}
+
+void NetworkEngine::beginSnapshot(int peer, quint64 sequence) {
+    NetCommand command;
+    command.type = NetCommand::SnapshotMarker;
+    command.peer = peer;
+    command.sequence = sequence;
+    submit(std::move(command));
+}
+
+void NetworkEngine::sendSnapshot(int peer, const QByteArray &frames) {
+    NetCommand command;
+    command.type = NetCommand::SendSnapshot;
+    command.peer = peer;
+    command.data = frames;
+    submit(std::move(command));
+}
+
+void NetworkEngine::submit(NetCommand &&command) {
+    outboundBacklog.enqueue(std::move(command));
+    flushOutbound();
+}
+
+void NetworkEngine::flushOutbound() {
+    while (!outboundBacklog.isEmpty() && outbound.push(std::move(outboundBacklog.head()))) {
+        outboundBacklog.dequeue();
+    }
+    if (!drainScheduled.exchange(true)) {
+        QMetaObject::invokeMethod(this, "drainOutbound", Qt::QueuedConnection);
+    }
+}
+
+bool NetworkEngine::takeEvent(NetEvent *event) {
+    if (!outboundBacklog.isEmpty()) {
+        flushOutbound();
+    }
+    return priorityInbound.pop(*event) || inbound.pop(*event);
+}
+
+void NetworkEngine::setMaxPlayers(int max) {
+    maxPlayers = max;
+}
+
+void NetworkEngine::startServer(quint16 port) {
+    statsTimer->start();
+    nextPeerId = Protocol::HostPlayer + 1;
+    server = new QTcpServer(this);
+    if (!server->listen(QHostAddress::Any, port)) {
+        postStatus("Server could not start!");
+        return;
+    }
+    connect(server, &QTcpServer::newConnection, this, &NetworkEngine::handleNewConnection);
+    postStatus("Server started on port " + QString::number(port));
+    postStatus("Your IP: " + server->serverAddress().toString());
+}
+
+void NetworkEngine::connectToHost(const QString &host, quint16 port, quint32 room) {
+    statsTimer->start();
+    roomId = room;
+    localPlayer = 0;
+    QTcpSocket *socket = new QTcpSocket(this);
+    connect(socket, &QTcpSocket::connected, this, [this, socket, host]() {
+        addPeer(socket);
+        postStatus("Connected to server at " + host);
+    });
+    connect(socket, &QTcpSocket::errorOccurred, this, [this, socket, host]() {
+        if (!peers.contains(socket)) {
+            postStatus("Could not connect to server at " + host);
+            socket->deleteLater();
+        }
+    });
+    socket->connectToHost(host, port);
+}
+
+void NetworkEngine::shutdown() {
+    backlogTimer->stop();
+    statsTimer->stop();
+    const QList<QTcpSocket*> sockets = peers.keys();
+    for (QTcpSocket *socket : sockets) {
+        socket->disconnect(this);
+        socket->disconnectFromHost();
+    }
+    peers.clear();
+    if (server) {
+        server->close();
+    }
+}
+
+void NetworkEngine::handleNewConnection() {
+    while (server->hasPendingConnections()) {
+        QTcpSocket *socket = server->nextPendingConnection();
+        if (peers.size() >= maxPlayers) {
+            socket->disconnectFromHost();
+            socket->deleteLater();
+            continue;
+        }
+        addPeer(socket);
+        peers[socket].syncing = true;
+        NetEvent event;
+        event.type = NetEvent::PeerJoined;
+        event.peer = peers[socket].id;
+        event.text = "New player connected";
+        post(std::move(event));
+    }
+}
+
+void NetworkEngine::addPeer(QTcpSocket *socket) {
+    Peer peer;
+    // Peer IDs travel as 16-bit origins, so once the counter wraps it skips
+    // IDs that connected peers still hold.
+    do {
+        peer.id = nextPeerId;
+        nextPeerId = nextPeerId == 0xFFFF ? Protocol::HostPlayer + 1 : nextPeerId + 1;
+    } while (findPeer(peer.id));
+    peers.insert(socket, peer);
+    connect(socket, &QTcpSocket::readyRead, this, &NetworkEngine::readPeerData);
+    connect(socket, &QTcpSocket::disconnected, this, &NetworkEngine::peerDisconnected);
+    connect(socket, &QTcpSocket::bytesWritten, this, &NetworkEngine::peerBytesWritten);
+    enqueue(socket, Protocol::encodeHello(roomId, server ? quint16(peer.id) : 0));
+}
+
+void NetworkEngine::readPeerData() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !peers.contains(socket)) return;
+
+    readAt = ClientMetrics::now();
+    QByteArray data = socket->readAll();
+    peers[socket].stats.bytesIn += quint64(data.size());
+    peers[socket].reader.append(data);
+    Protocol::Frame frame;
+    while (peers.contains(socket) && peers[socket].reader.readFrame(&frame)) {
+        handleFrame(socket, frame);
+    }
+}
+
+void NetworkEngine::handleFrame(QTcpSocket *socket, const Protocol::Frame &frame) {
+    Peer &peer = peers[socket];
+    ++peer.stats.messagesIn;
+    if (!peer.greeted || frame.opcode == Protocol::Hello) {
+        quint8 version = 0;
+        quint32 room = 0;
+        quint16 player = 0;
+        if (frame.opcode != Protocol::Hello || !Protocol::decodeHello(frame.payload, &version, &room, &player) || version != Protocol::Version) {
+            postStatus("Rejected peer with incompatible protocol");
+            socket->abort();
+            return;
+        }
+        peer.greeted = true;
+        // A relay only knows the ID once the client is in a room, so it
+        // comes in a second Hello.
+        if (!server && player != 0) localPlayer = player;
+        return;
+    }
+
+    NetEvent event;
+    event.peer = peer.id;
+    event.receivedAt = readAt;
+    OriginState &origin = peer.origins[frame.origin];
+    if (Protocol::isRelayedOpcode(frame.opcode)) {
+        // Chat may overtake queued strokes, so it is checked on its own.
+        quint32 &lastSequence = frame.opcode == Protocol::Chat ? origin.lastChatSequence : origin.lastSequence;
+        if (frame.sequence != 0) {
+            if (frame.sequence <= lastSequence) {
+                ++peer.stats.duplicateFrames;
+                return;
+            }
+            lastSequence = frame.sequence;
+        }
+        if (!server && frame.origin != 0) event.peer = frame.origin == localPlayer ? 0 : frame.origin;
+    }
+    switch (frame.opcode) {
+    case Protocol::Chat:
+        if (!Protocol::decodeChat(frame.payload, &event.text)) return;
+        event.type = NetEvent::Chat;
+        break;
+    case Protocol::StrokeBegin: {
+        Protocol::StrokeStart start;
+        if (!Protocol::decodeStrokeBegin(frame.payload, &start)) return;
+        event.type = NetEvent::StrokeBegin;
+        event.point = start.point;
+        event.brushSize = start.brushSize;
+        event.color = start.color;
+        origin.lastPoint = start.point;
+        break;
+    }
+    case Protocol::StrokePoint: {
+        QPoint point;
+        if (!Protocol::decodeStrokePoint(frame.payload, &point)) return;
+        event.type = NetEvent::StrokePoints;
+        event.points.append(point);
+        origin.lastPoint = point;
+        break;
+    }
+    case Protocol::StrokePoints:
+        if (!Protocol::decodeStrokePoints(frame.payload, origin.lastPoint, &event.points)) return;
+        event.type = NetEvent::StrokePoints;
+        if (!event.points.isEmpty()) origin.lastPoint = event.points.last();
+        break;
+    case Protocol::StrokeEnd:
+        event.type = NetEvent::StrokeEnd;
+        break;
+    case Protocol::Undo:
+        event.type = NetEvent::Undo;
+        break;
+    case Protocol::Redo:
+        event.type = NetEvent::Redo;
+        break;
+    case Protocol::SnapshotData:
+        if (server) return;
+        peer.snapshot.append(frame.payload);
+        if (peer.snapshot.size() > MaxSnapshotSize) {
+            postStatus("Snapshot from host is too large");
+            socket->abort();
+        }
+        return;
+    case Protocol::SnapshotDone:
+        if (server) return;
+        event.type = NetEvent::Snapshot;
+        event.data = peer.snapshot;
+        peer.snapshot.clear();
+        post(std::move(event));
+        return;
+    case Protocol::Ping: {
+        qint64 time = 0;
+        if (Protocol::decodePing(frame.payload, &time)) {
+            enqueue(socket, Protocol::encodePong(time, ClientMetrics::now()));
+        }
+        return;
+    }
+    case Protocol::Pong: {
+        qint64 sent = 0;
+        qint64 remote = 0;
+        if (Protocol::decodePong(frame.payload, &sent, &remote)) {
+            recordClockSample(peer, sent, remote, readAt);
+        }
+        return;
+    }
+    default:
+        return;
+    }
+
+    if (Protocol::isCanvasOpcode(frame.opcode)) {
+        event.sequence = nextSequence++;
+    }
+    quint64 sequence = event.sequence;
+    quint16 player = quint16(event.peer);
+    post(std::move(event));
+    if (server) {
+        relay(Protocol::encodeFrame(frame.opcode, frame.payload, player, frame.sequence), sequence, false, socket);
+    }
+}
+
+void NetworkEngine::peerDisconnected() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket) return;
+    if (!peers.contains(socket)) return;
+    const Peer peer = peers.take(socket);
+    socket->deleteLater();
+    if (server && peer.greeted) {
+        relay(Protocol::encodeFrame(Protocol::StrokeEnd, QByteArray(), quint16(peer.id)), nextSequence++, false);
+    }
+    NetEvent event;
+    event.type = NetEvent::PeerLeft;
+    event.peer = peer.id;
+    event.text = "Player disconnected";
+    post(std::move(event));
+}
+
+void NetworkEngine::relay(const QByteArray &frame, quint64 sequence, bool local, QTcpSocket *source) {
+    bool stroke = Protocol::isCanvasOpcode(quint8(frame[0]));
+    for (auto it = peers.begin(); it != peers.end(); ++it) {
+        Peer &peer = it.value();
+        if (!peer.greeted || it.key() == source) continue;
+        if (stroke && peer.syncing) {
+            HeldFrame held;
+            held.sequence = sequence;
+            held.local = local;
+            held.frame = frame;
+            peer.held.append(held);
+        } else {
+            enqueue(it.key(), frame);
+        }
+    }
+}
+
+QTcpSocket *NetworkEngine::findPeer(int id) const {
+    for (auto it = peers.constBegin(); it != peers.constEnd(); ++it) {
+        if (it.value().id == id) return it.key();
+    }
+    return nullptr;
+}
+
+void NetworkEngine::drainOutbound() {
+    drainScheduled = false;
+    NetCommand command;
+    while (outbound.pop(command)) {
+        handleCommand(command);
+    }
+}
+
+void NetworkEngine::handleCommand(NetCommand &command) {
+    if (command.type == NetCommand::Broadcast) {
+        if (command.data.size() < Protocol::HeaderSize) return;
+        quint8 opcode = quint8(command.data[0]);
+        quint64 sequence = Protocol::isCanvasOpcode(opcode) ? nextSequence++ : 0;
+        if (Protocol::isRelayedOpcode(opcode)) {
+            Protocol::stampFrame(&command.data, 0, server ? Protocol::HostPlayer : 0, ++localSequence);
+        }
+        relay(command.data, sequence, true);
+        return;
+    }
+
+    QTcpSocket *socket = findPeer(command.peer);
+    if (!socket) return;
+    Peer &peer = peers[socket];
+    if (!peer.syncing) return;
+
+    if (command.type == NetCommand::SnapshotMarker) {
+        QVector<HeldFrame> pending;
+        for (const HeldFrame &held : peer.held) {
+            if (!held.local && held.sequence > command.sequence) {
+                pending.append(held);
+            }
+        }
+        peer.held = pending;
+    } else {
+        QVector<HeldFrame> held = peer.held;
+        peer.held.clear();
+        peer.syncing = false;
+        // The snapshot and the unsettled strokes after it go out a frame at
+        // a time, with the image cut into pieces well under the write
+        // budget so control and chat frames can go out between them.
+        for (const QByteArray &frame : splitFrames(command.data)) {
+            if (quint8(frame[0]) != Protocol::SnapshotData) {
+                enqueue(socket, frame, SnapshotLane);
+                continue;
+            }
+            for (int offset = Protocol::HeaderSize; offset < frame.size(); offset += SnapshotChunk) {
+                enqueue(socket, Protocol::encodeFrame(Protocol::SnapshotData, frame.mid(offset, SnapshotChunk)), SnapshotLane);
+            }
+        }
+        for (const HeldFrame &frame : held) {
+            enqueue(socket, frame.frame);
+        }
+    }
+}
+
+NetworkEngine::Lane NetworkEngine::laneFor(const QByteArray &frames) {
+    quint8 opcode = frames.isEmpty() ? 0 : quint8(frames[0]);
+    if (opcode == Protocol::Chat) return ChatLane;
+    if (Protocol::isCanvasOpcode(opcode)) return StrokeLane;
+    return ControlLane;
+}
+
+bool NetworkEngine::isPriorityEvent(const NetEvent &event) {
+    return event.type == NetEvent::Status || event.type == NetEvent::Chat || event.type == NetEvent::PeerStatsUpdated;
+}
+
+// Queued snapshot data is left out: it goes out exactly once and can be
+// neither thinned nor discarded, so it says nothing about whether the peer
+// keeps up with the live stream.
+qint64 NetworkEngine::backlog(const Peer &peer, QTcpSocket *socket) {
+    return peer.queuedBytes - peer.snapshotBytes + socket->bytesToWrite();
+}
+
+void NetworkEngine::enqueue(QTcpSocket *socket, const QByteArray &frames) {
+    enqueue(socket, frames, laneFor(frames));
+}
+
+void NetworkEngine::enqueue(QTcpSocket *socket, const QByteArray &frames, Lane lane) {
+    Peer &peer = peers[socket];
+    peer.lanes[lane].enqueue(frames);
+    peer.queuedBytes += frames.size();
+    if (lane == SnapshotLane) peer.snapshotBytes += frames.size();
+    if (backlog(peer, socket) > HighWaterMark) {
+        relieve(socket);
+    }
+    pump(socket);
+}
+
+// A frame bigger than the whole budget still goes out once the socket has
+// drained, so nothing can get stuck.
+static bool fitsBudget(QTcpSocket *socket, const QByteArray &frames) {
+    const qint64 pending = socket->bytesToWrite();
+    return pending == 0 || pending + frames.size() <= WriteBudget;
+}
+
+// A lower lane only gets the budget once every higher lane is empty, so a
+// control or chat frame waits behind at most one budget of other data.
+void NetworkEngine::pump(QTcpSocket *socket) {
+    Peer &peer = peers[socket];
+    for (int lane = 0; lane < LaneCount; ++lane) {
+        QQueue<QByteArray> &queue = peer.lanes[lane];
+        while (!queue.isEmpty() && fitsBudget(socket, queue.head())) {
+            QByteArray frames = queue.dequeue();
+            peer.queuedBytes -= frames.size();
+            if (lane == SnapshotLane) peer.snapshotBytes -= frames.size();
+            advanceStrokePoints(frames, &peer.sentPoints);
+            peer.stats.bytesOut += quint64(frames.size());
+            peer.stats.messagesOut += quint64(countFrames(frames));
+            socket->write(frames);
+        }
+        if (!queue.isEmpty()) break;
+    }
+    if (backlog(peer, socket) < LowWaterMark) {
+        peer.congestedSince.invalidate();
+    }
+}
+
+void NetworkEngine::peerBytesWritten() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket && peers.contains(socket)) {
+        pump(socket);
+    }
+}
+
+void NetworkEngine::relieve(QTcpSocket *socket) {
+    Peer &peer = peers[socket];
+    coalesce(peer);
+
+    if (backlog(peer, socket) > HighWaterMark && server && !peer.syncing) {
+        QQueue<QByteArray> kept;
+        for (const QByteArray &frames : peer.lanes[StrokeLane]) {
+            Protocol::Frame frame;
+            if (readSingleFrame(frames, &frame) && Protocol::isCanvasOpcode(frame.opcode)) {
+                ++peer.stats.discardedFrames;
+                peer.queuedBytes -= frames.size();
+                continue;
+            }
+            kept.enqueue(frames);
+        }
+        peer.lanes[StrokeLane] = kept;
+        peer.syncing = true;
+
+        NetEvent event;
+        event.type = NetEvent::ResyncRequested;
+        event.peer = peer.id;
+        post(std::move(event));
+    }
+
+    if (backlog(peer, socket) <= HighWaterMark) return;
+    if (!peer.congestedSince.isValid()) {
+        peer.congestedSince.start();
+    } else if (peer.congestedSince.elapsed() > StallTimeoutMs) {
+        postStatus("Dropped a player whose connection stalled");
+        QTimer::singleShot(0, socket, [socket]() { socket->abort(); });
+    }
+}
+
+void NetworkEngine::coalesce(Peer &peer) {
+    QQueue<QByteArray> &lane = peer.lanes[StrokeLane];
+    QQueue<QByteArray> result;
+    qint64 laneBytes = 0;
+    qint64 resultBytes = 0;
+    // Unsettled strokes still queued with a snapshot go out first, and the
+    // frames behind them continue from their points.
+    QHash<quint16, QPoint> current = peer.sentPoints;
+    for (const QByteArray &frames : peer.lanes[SnapshotLane]) {
+        advanceStrokePoints(frames, &current);
+    }
+    quint16 runOrigin = 0;
+    quint32 runSequence = 0;
+    QPoint runStart;
+    QVector<QPoint> run;
+    int runFrames = 0;
+
+    auto flushRun = [&]() {
+        if (run.isEmpty()) return;
+        QVector<QPoint> kept = thinPoints(run, CoalesceTolerance);
+        QByteArray frame = Protocol::encodeStrokePoints(runStart, kept);
+        Protocol::stampFrame(&frame, 0, runOrigin, runSequence);
+        result.enqueue(frame);
+        resultBytes += frame.size();
+        peer.stats.coalescedFrames += quint64(runFrames - 1);
+        peer.stats.droppedSamples += quint64(run.size() - kept.size());
+        run.clear();
+        runFrames = 0;
+    };
+
+    // Runs only merge samples from one origin, since each origin's deltas
+    // continue from its own previous point.
+    for (const QByteArray &frames : lane) {
+        laneBytes += frames.size();
+        Protocol::Frame frame;
+        QVector<QPoint> points;
+        QPoint single;
+        bool samples = false;
+        if (readSingleFrame(frames, &frame)) {
+            if (frame.opcode == Protocol::StrokePoints) {
+                samples = Protocol::decodeStrokePoints(frame.payload, current.value(frame.origin), &points);
+            } else if (frame.opcode == Protocol::StrokePoint && Protocol::decodeStrokePoint(frame.payload, &single)) {
+                points.append(single);
+                samples = true;
+            }
+        }
+        if (samples) {
+            if (!run.isEmpty() && frame.origin != runOrigin) flushRun();
+            if (run.isEmpty()) {
+                runOrigin = frame.origin;
+                runStart = current.value(frame.origin);
+            }
+            run += points;
+            runSequence = frame.sequence;
+            ++runFrames;
+            if (!points.isEmpty()) current[frame.origin] = points.last();
+            if (run.size() >= MaxCoalescedPoints) flushRun();
+            continue;
+        }
+        flushRun();
+        result.enqueue(frames);
+        resultBytes += frames.size();
+        advanceStrokePoints(frames, &current);
+    }
+    flushRun();
+
+    lane = result;
+    peer.queuedBytes += resultBytes - laneBytes;
+}
+
+void NetworkEngine::recordClockSample(Peer &peer, qint64 sent, qint64 remote, qint64 received) {
+    ClockSample sample;
+    sample.rtt = qMax<qint64>(0, received - sent);
+    sample.offset = remote - (sent + sample.rtt / 2);
+    peer.clockSamples.append(sample);
+    if (peer.clockSamples.size() > ClockSampleWindow) {
+        peer.clockSamples.removeFirst();
+    }
+
+    PeerStats &stats = peer.stats;
+    stats.rttMicros = stats.rttMicros < 0 ? sample.rtt : (7 * stats.rttMicros + sample.rtt) / 8;
+    const ClockSample *best = &peer.clockSamples.first();
+    for (const ClockSample &candidate : peer.clockSamples) {
+        if (candidate.rtt < best->rtt) best = &candidate;
+    }
+    stats.clockOffsetMicros = best->offset;
+}
+
+void NetworkEngine::publishStats() {
+    qint64 now = ClientMetrics::now();
+    for (auto it = peers.begin(); it != peers.end(); ++it) {
+        Peer &peer = it.value();
+        if (peer.greeted) {
+            enqueue(it.key(), Protocol::encodePing(now));
+        }
+        peer.stats.queuedBytes = peer.queuedBytes + it.key()->bytesToWrite();
+        peer.stats.queuedFrames = 0;
+        for (const QQueue<QByteArray> &lane : peer.lanes) {
+            peer.stats.queuedFrames += lane.size();
+        }
+        peer.stats.bytesInPerSecond = qint64(peer.stats.bytesIn - peer.publishedBytesIn);
+        peer.stats.bytesOutPerSecond = qint64(peer.stats.bytesOut - peer.publishedBytesOut);
+        peer.publishedBytesIn = peer.stats.bytesIn;
+        peer.publishedBytesOut = peer.stats.bytesOut;
+        NetEvent event;
+        event.type = NetEvent::PeerStatsUpdated;
+        event.peer = peer.id;
+        event.stats = peer.stats;
+        post(std::move(event));
+    }
+}
+
+void NetworkEngine::post(NetEvent &&event) {
+    if (isPriorityEvent(event)) {
+        priorityBacklog.enqueue(std::move(event));
+    } else {
+        inboundBacklog.enqueue(std::move(event));
+    }
+    flushEvents();
+}
+
+void NetworkEngine::postStatus(const QString &text) {
+    NetEvent event;
+    event.type = NetEvent::Status;
+    event.text = text;
+    post(std::move(event));
+}
+
+void NetworkEngine::flushEvents() {
+    while (!priorityBacklog.isEmpty() && priorityInbound.push(std::move(priorityBacklog.head()))) {
+        priorityBacklog.dequeue();
+    }
+    while (!inboundBacklog.isEmpty() && inbound.push(std::move(inboundBacklog.head()))) {
+        inboundBacklog.dequeue();
+    }
+    if (priorityBacklog.isEmpty() && inboundBacklog.isEmpty()) {
+        backlogTimer->stop();
+    } else if (!backlogTimer->isActive()) {
+        backlogTimer->start();
+    }
+}
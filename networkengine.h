@@ -0,0 +1,234 @@
+#ifndef NETWORKENGINE_H
+#define NETWORKENGINE_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QQueue>
+#include <QVector>
+#include <QPoint>
+#include <QString>
+#include <QElapsedTimer>
+#include <atomic>
+#include "protocol.h"
+#include "spscqueue.h"
+#include "metrics.h"
+
+class QTimer;
+
+struct PeerStats {
+    qint64 queuedBytes = 0;
+    int queuedFrames = 0;
+    quint64 coalescedFrames = 0;
+    quint64 droppedSamples = 0;
+    quint64 discardedFrames = 0;
+    quint64 duplicateFrames = 0;
+    qint64 rttMicros = -1;
+    qint64 clockOffsetMicros = 0;
+    quint64 bytesIn = 0;
+    quint64 bytesOut = 0;
+    quint64 messagesIn = 0;
+    quint64 messagesOut = 0;
+    qint64 bytesInPerSecond = 0;
+    qint64 bytesOutPerSecond = 0;
+};
+
+// For chat and canvas events peer is the player who produced them, which
+// on a client may be any player in the room rather than the host itself;
+// every other event is about the connection with that ID.
+struct NetEvent {
+    enum Type {
+        Status,
+        PeerJoined,
+        PeerLeft,
+        Chat,
+        StrokeBegin,
+        StrokePoints,
+        StrokeEnd,
+        Undo,
+        Redo,
+        Snapshot,
+        ResyncRequested,
+        PeerStatsUpdated
+    };
+
+    Type type = Status;
+    int peer = 0;
+    quint64 sequence = 0;
+    qint64 receivedAt = 0;
+    QString text;
+    QPoint point;
+    int brushSize = 0;
+    quint32 color = 0;
+    QVector<QPoint> points;
+    QByteArray data;
+    PeerStats stats;
+};
+
+struct NetCommand {
+    enum Type {
+        Broadcast,
+        SnapshotMarker,
+        SendSnapshot
+    };
+
+    Type type = Broadcast;
+    int peer = 0;
+    quint64 sequence = 0;
+    QByteArray data;
+};
+
+// Owns the listening server and every peer socket and lives on its own
+// QThread. Decoded traffic reaches the GUI through an SPSC queue that the
+// GUI drains once per frame with takeEvent(); frames to send travel the
+// other way through send().
+//
+// Every stroke frame gets a sequence number. A peer that joins a host is
+// held in a syncing state: stroke traffic for it is buffered until the GUI
+// marks which sequence its snapshot covers (beginSnapshot) and delivers the
+// encoded snapshot (sendSnapshot), after which only the buffered frames the
+// snapshot does not already contain are flushed to it.
+//
+// Each peer has a send queue per traffic class. Whenever the socket has
+// room under the write budget, control frames go first, then chat, then
+// snapshot data, and stroke batches fill whatever is left. Frames are only
+// handed to the socket while they fit in the budget, and snapshots are cut
+// into pieces well under it, so a chat line or a ping never waits behind
+// more than one budget of samples or image data. Strokes cannot
+// overtake a snapshot queued before them. Decoded events are split
+// the same way: chat, status and stats reach the GUI through their own
+// queue ahead of canvas traffic. Join, leave and resync events stay in
+// line with the canvas, since the snapshots they trigger have to cover
+// exactly the strokes applied before them. Once a peer's backlog passes
+// the high-water mark its queued stroke samples are merged and thinned; if
+// that is not enough the host discards them and resyncs the peer from a
+// fresh snapshot, and a peer that stays congested is dropped. Snapshot
+// data still waiting to go out does not count towards the backlog, so a
+// snapshot larger than the mark does not trigger another resync.
+//
+// Chat and canvas frames leave stamped with this side's origin and its
+// own running sequence number. The host decodes each origin's samples and
+// sequence numbers separately, drops anything it has already seen, and
+// passes frames on to every peer except the one they came from; a client
+// never relays. Whatever a player left mid-stroke is closed for everyone
+// else when it disconnects. The host tells each client the ID it gave it
+// in its Hello, and the client reports frames stamped with that ID, which
+// only come back inside snapshots, as its own (peer 0).
+//
+// Every stats tick also pings each peer. The smoothed round-trip time and
+// the clock offset from the fastest of the last few exchanges are
+// published with the per-connection byte and message counters.
+class NetworkEngine : public QObject {
+    Q_OBJECT
+public:
+    explicit NetworkEngine(QObject *parent = nullptr);
+
+    void send(const QByteArray &frame);
+    void beginSnapshot(int peer, quint64 sequence);
+    void sendSnapshot(int peer, const QByteArray &frames);
+    bool takeEvent(NetEvent *event);
+    void setMaxPlayers(int max);
+
+public slots:
+    void startServer(quint16 port);
+    void connectToHost(const QString &host, quint16 port, quint32 room);
+    void shutdown();
+
+private slots:
+    void handleNewConnection();
+    void readPeerData();
+    void peerDisconnected();
+    void drainOutbound();
+    void flushEvents();
+    void peerBytesWritten();
+    void publishStats();
+
+private:
+    // Outbound traffic classes, in the order pump() serves them.
+    enum Lane {
+        ControlLane,
+        ChatLane,
+        SnapshotLane,
+        StrokeLane,
+        LaneCount
+    };
+
+    struct HeldFrame {
+        quint64 sequence = 0;
+        bool local = false;
+        QByteArray frame;
+    };
+
+    struct OriginState {
+        QPoint lastPoint;
+        quint32 lastSequence = 0;
+        quint32 lastChatSequence = 0;
+    };
+
+    struct ClockSample {
+        qint64 rtt = 0;
+        qint64 offset = 0;
+    };
+
+    struct Peer {
+        int id = 0;
+        FrameReader reader;
+        bool greeted = false;
+        QHash<quint16, OriginState> origins;
+        bool syncing = false;
+        QVector<HeldFrame> held;
+        QByteArray snapshot;
+        QQueue<QByteArray> lanes[LaneCount];
+        qint64 queuedBytes = 0;
+        qint64 snapshotBytes = 0;
+        QHash<quint16, QPoint> sentPoints;
+        QElapsedTimer congestedSince;
+        QVector<ClockSample> clockSamples;
+        quint64 publishedBytesIn = 0;
+        quint64 publishedBytesOut = 0;
+        PeerStats stats;
+    };
+
+    void submit(NetCommand &&command);
+    void flushOutbound();
+    void addPeer(QTcpSocket *socket);
+    void handleFrame(QTcpSocket *socket, const Protocol::Frame &frame);
+    void handleCommand(NetCommand &command);
+    void relay(const QByteArray &frame, quint64 sequence, bool local, QTcpSocket *source = nullptr);
+    static Lane laneFor(const QByteArray &frames);
+    static bool isPriorityEvent(const NetEvent &event);
+    static qint64 backlog(const Peer &peer, QTcpSocket *socket);
+    void enqueue(QTcpSocket *socket, const QByteArray &frames);
+    void enqueue(QTcpSocket *socket, const QByteArray &frames, Lane lane);
+    void pump(QTcpSocket *socket);
+    void relieve(QTcpSocket *socket);
+    void coalesce(Peer &peer);
+    void recordClockSample(Peer &peer, qint64 sent, qint64 remote, qint64 received);
+    QTcpSocket *findPeer(int id) const;
+    void post(NetEvent &&event);
+    void postStatus(const QString &text);
+
+    QTcpServer *server;
+    QHash<QTcpSocket*, Peer> peers;
+    int nextPeerId;
+    quint32 roomId;
+    quint16 localPlayer;
+    quint64 nextSequence;
+    quint32 localSequence;
+    qint64 readAt;
+    std::atomic<int> maxPlayers;
+    QTimer *backlogTimer;
+    QTimer *statsTimer;
+
+    SpscQueue<NetEvent, 1024> priorityInbound;
+    QQueue<NetEvent> priorityBacklog;
+    SpscQueue<NetEvent, 4096> inbound;
+    QQueue<NetEvent> inboundBacklog;
+
+    SpscQueue<NetCommand, 1024> outbound;
+    QQueue<NetCommand> outboundBacklog;
+    std::atomic<bool> drainScheduled;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "polyline.h"
+#include <QPair>
+#include <algorithm>
+
+namespace {
+
+double distanceSquared(const QPoint &point, const QPoint &from, const QPoint &to) {
+    double dx = to.x() - from.x();
+    double dy = to.y() - from.y();
+    double lengthSquared = dx * dx + dy * dy;
+    double t = 0;
+    if (lengthSquared > 0) {
+        t = qBound(0.0, ((point.x() - from.x()) * dx + (point.y() - from.y()) * dy) / lengthSquared, 1.0);
+    }
+    double px = from.x() + t * dx - point.x();
+    double py = from.y() + t * dy - point.y();
+    return px * px + py * py;
+}
+
+}
+
+namespace Polyline {
+
+QVector<int> simplify(const QPoint *points, int count, double tolerance) {
+    QVector<int> kept;
+    if (count <= 2 || tolerance <= 0) {
+        for (int i = 0; i < count; ++i) kept.append(i);
+        return kept;
+    }
+
+    QVector<bool> keep(count, false);
+    keep[0] = true;
+    keep[count - 1] = true;
+    double limit = tolerance * tolerance;
+    QVector<QPair<int, int>> spans;
+    spans.append(qMakePair(0, count - 1));
+    while (!spans.isEmpty()) {
+        QPair<int, int> span = spans.takeLast();
+        double worst = 0;
+        int split = -1;
+        for (int i = span.first + 1; i < span.second; ++i) {
+            double distance = distanceSquared(points[i], points[span.first], points[span.second]);
+            if (distance > worst) {
+                worst = distance;
+                split = i;
+            }
+        }
+        if (split >= 0 && worst > limit) {
+            keep[split] = true;
+            spans.append(qMakePair(span.first, split));
+            spans.append(qMakePair(split, span.second));
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (keep[i]) kept.append(i);
+    }
+    return kept;
+}
+
+}
@@ -0,0 +1,16 @@
+#ifndef POLYLINE_H
+#define POLYLINE_H
+
+#include <QPoint>
+#include <QVector>
+
+namespace Polyline {
+
+// Ramer-Douglas-Peucker: returns the indices of the points to keep so that
+// no dropped point lies further than tolerance pixels from the simplified
+// line. The first and last points are always kept.
+QVector<int> simplify(const QPoint *points, int count, double tolerance);
+
+}
+
+#endif
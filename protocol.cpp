@@ -0,0 +1,258 @@
+#include "protocol.h"
+#include <QtEndian>
+
+namespace {
+
+void appendUInt8(QByteArray &out, quint8 value) {
+    out.append(char(value));
+}
+
+void appendUInt16(QByteArray &out, quint16 value) {
+    char bytes[2];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 2);
+}
+
+void appendUInt32(QByteArray &out, quint32 value) {
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 4);
+}
+
+void appendUInt64(QByteArray &out, quint64 value) {
+    char bytes[8];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 8);
+}
+
+void appendPoint(QByteArray &out, const QPoint &point) {
+    appendUInt16(out, quint16(qint16(qBound(-32768, point.x(), 32767))));
+    appendUInt16(out, quint16(qint16(qBound(-32768, point.y(), 32767))));
+}
+
+void appendVarint(QByteArray &out, quint32 value) {
+    while (value >= 0x80) {
+        out.append(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+bool readVarint(const QByteArray &in, int *pos, quint32 *value) {
+    quint32 result = 0;
+    for (int shift = 0; shift < 35 && *pos < in.size(); shift += 7) {
+        quint8 byte = quint8(in[(*pos)++]);
+        result |= quint32(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+quint32 zigzag(qint32 value) {
+    return (quint32(value) << 1) ^ quint32(value >> 31);
+}
+
+qint32 unzigzag(quint32 value) {
+    return qint32(value >> 1) ^ -qint32(value & 1);
+}
+
+QPoint readPoint(const char *data) {
+    return QPoint(qFromLittleEndian<qint16>(data), qFromLittleEndian<qint16>(data + 2));
+}
+
+}
+
+namespace Protocol {
+
+QByteArray encodeFrame(quint8 opcode, const QByteArray &payload, quint16 origin, quint32 sequence) {
+    QByteArray frame;
+    frame.reserve(HeaderSize + payload.size());
+    appendUInt8(frame, opcode);
+    appendUInt16(frame, quint16(payload.size()));
+    appendUInt16(frame, origin);
+    appendUInt32(frame, sequence);
+    frame.append(payload);
+    return frame;
+}
+
+void stampFrame(QByteArray *frames, int offset, quint16 origin, quint32 sequence) {
+    char *header = frames->data() + offset;
+    qToLittleEndian(origin, header + 3);
+    qToLittleEndian(sequence, header + 5);
+}
+
+QByteArray encodeHello(quint32 room, quint16 player) {
+    QByteArray payload;
+    appendUInt8(payload, Version);
+    appendUInt32(payload, room);
+    appendUInt16(payload, player);
+    return encodeFrame(Hello, payload);
+}
+
+QByteArray encodeChat(const QString &message) {
+    QByteArray text = message.toUtf8();
+    if (text.size() > MaxPayloadSize) {
+        // Cut before the lead byte of any sequence the limit splits.
+        int length = MaxPayloadSize;
+        while (length > 0 && (quint8(text[length]) & 0xC0) == 0x80) {
+            --length;
+        }
+        text.truncate(length);
+    }
+    return encodeFrame(Chat, text);
+}
+
+QByteArray encodeStrokeBegin(const QPoint &point, int brushSize, quint32 color) {
+    QByteArray payload;
+    appendPoint(payload, point);
+    appendUInt8(payload, quint8(qBound(1, brushSize, 255)));
+    appendUInt32(payload, color);
+    return encodeFrame(StrokeBegin, payload);
+}
+
+QByteArray encodeStrokePoint(const QPoint &point) {
+    QByteArray payload;
+    appendPoint(payload, point);
+    return encodeFrame(StrokePoint, payload);
+}
+
+QByteArray encodeStrokePoints(const QPoint &origin, const QVector<QPoint> &points) {
+    QByteArray payload;
+    payload.reserve(points.size() * 2);
+    QPoint previous = origin;
+    for (const QPoint &point : points) {
+        appendVarint(payload, zigzag(point.x() - previous.x()));
+        appendVarint(payload, zigzag(point.y() - previous.y()));
+        previous = point;
+    }
+    return encodeFrame(StrokePoints, payload);
+}
+
+QByteArray encodeStrokeEnd() {
+    return encodeFrame(StrokeEnd);
+}
+
+QByteArray encodeSnapshot(const QByteArray &image) {
+    QByteArray frames;
+    for (int offset = 0; offset < image.size(); offset += MaxPayloadSize) {
+        frames.append(encodeFrame(SnapshotData, image.mid(offset, MaxPayloadSize)));
+    }
+    frames.append(encodeFrame(SnapshotDone));
+    return frames;
+}
+
+QByteArray encodeUndo() {
+    return encodeFrame(Undo);
+}
+
+QByteArray encodeRedo() {
+    return encodeFrame(Redo);
+}
+
+QByteArray encodePing(qint64 time) {
+    QByteArray payload;
+    appendUInt64(payload, quint64(time));
+    return encodeFrame(Ping, payload);
+}
+
+QByteArray encodePong(qint64 echoedTime, qint64 time) {
+    QByteArray payload;
+    appendUInt64(payload, quint64(echoedTime));
+    appendUInt64(payload, quint64(time));
+    return encodeFrame(Pong, payload);
+}
+
+bool decodeHello(const QByteArray &payload, quint8 *version, quint32 *room, quint16 *player) {
+    if (payload.size() != 7) return false;
+    *version = quint8(payload[0]);
+    *room = qFromLittleEndian<quint32>(payload.constData() + 1);
+    *player = qFromLittleEndian<quint16>(payload.constData() + 5);
+    return true;
+}
+
+bool decodeChat(const QByteArray &payload, QString *message) {
+    *message = QString::fromUtf8(payload);
+    return true;
+}
+
+bool decodeStrokeBegin(const QByteArray &payload, StrokeStart *start) {
+    if (payload.size() != 9) return false;
+    const char *data = payload.constData();
+    start->point = readPoint(data);
+    start->brushSize = quint8(data[4]);
+    start->color = qFromLittleEndian<quint32>(data + 5);
+    return true;
+}
+
+bool decodeStrokePoint(const QByteArray &payload, QPoint *point) {
+    if (payload.size() != 4) return false;
+    *point = readPoint(payload.constData());
+    return true;
+}
+
+bool decodeStrokePoints(const QByteArray &payload, const QPoint &origin, QVector<QPoint> *points) {
+    points->clear();
+    QPoint previous = origin;
+    int pos = 0;
+    while (pos < payload.size()) {
+        quint32 dx = 0;
+        quint32 dy = 0;
+        if (!readVarint(payload, &pos, &dx) || !readVarint(payload, &pos, &dy)) return false;
+        previous = QPoint(previous.x() + unzigzag(dx), previous.y() + unzigzag(dy));
+        points->append(previous);
+    }
+    return true;
+}
+
+bool decodePing(const QByteArray &payload, qint64 *time) {
+    if (payload.size() != 8) return false;
+    *time = qint64(qFromLittleEndian<quint64>(payload.constData()));
+    return true;
+}
+
+bool decodePong(const QByteArray &payload, qint64 *echoedTime, qint64 *time) {
+    if (payload.size() != 16) return false;
+    *echoedTime = qint64(qFromLittleEndian<quint64>(payload.constData()));
+    *time = qint64(qFromLittleEndian<quint64>(payload.constData() + 8));
+    return true;
+}
+
+bool isCanvasOpcode(quint8 opcode) {
+    return opcode == StrokeBegin || opcode == StrokePoint || opcode == StrokePoints || opcode == StrokeEnd
+        || opcode == Undo || opcode == Redo;
+}
+
+bool isRelayedOpcode(quint8 opcode) {
+    return opcode == Chat || isCanvasOpcode(opcode);
+}
+
+}
+
+void FrameReader::append(const QByteArray &data) {
+    if (offset > 0 && offset >= buffer.size() / 2) {
+        buffer.remove(0, offset);
+        offset = 0;
+    }
+    buffer.append(data);
+}
+
+bool FrameReader::readFrame(Protocol::Frame *frame) {
+    if (buffer.size() - offset < Protocol::HeaderSize) return false;
+    const char *header = buffer.constData() + offset;
+    int length = qFromLittleEndian<quint16>(header + 1);
+    if (buffer.size() - offset < Protocol::HeaderSize + length) return false;
+    frame->opcode = quint8(header[0]);
+    frame->origin = qFromLittleEndian<quint16>(header + 3);
+    frame->sequence = qFromLittleEndian<quint32>(header + 5);
+    frame->payload = buffer.mid(offset + Protocol::HeaderSize, length);
+    offset += Protocol::HeaderSize + length;
+    return true;
+}
+
+void FrameReader::clear() {
+    buffer.clear();
+    offset = 0;
+}
@@ -0,0 +1,109 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <QByteArray>
+#include <QPoint>
+#include <QString>
+#include <QVector>
+
+// Every frame is a 9-byte header (opcode, then little-endian payload
+// length, origin player and sequence number) followed by the payload.
+// Chat and canvas frames are stamped with the player who produced them and
+// that player's own running sequence number; the host (or relay) overwrites
+// the origin of whatever a connection sends with the ID it gave that
+// connection and passes the frame on to everyone except its origin, and a
+// receiver drops a frame whose sequence it has already seen from that
+// origin. Chat and canvas frames are checked against separate high-water
+// marks, because senders let chat overtake queued strokes and only the
+// order within each class is preserved. Sequence 0 means unsequenced and
+// is never dropped. The host speaks as HostPlayer, which is also the ID a
+// client gives its one connection, so host-assigned client IDs start
+// above it. Point-to-point frames carry origin 0. Both sides open with
+// Hello (version, room ID, player ID) so mismatched protocol versions are
+// rejected before any drawing traffic flows and a relay can route the
+// connection to its room. The player ID is the one the host gave the
+// receiving client, or 0 when the sender has none to give; a relay sends
+// a second Hello with it once the client is in a room. A client treats
+// frames stamped with its own ID, which only snapshots carry, as its own.
+// StrokePoints carries a run of samples as zigzag varint deltas from the
+// previous point of the same origin, so interleaved players decode
+// independently. A late joiner receives the settled
+// canvas as a PNG split over SnapshotData frames and closed by SnapshotDone.
+// Ping carries the sender's clock in microseconds; the receiver answers
+// straight away with a Pong echoing it next to its own clock, which gives
+// the sender the round-trip time and the offset between the two clocks.
+// Neither is ever relayed.
+namespace Protocol {
+
+const quint8 Version = 5;
+const int HeaderSize = 9;
+const int MaxPayloadSize = 0xFFFF;
+const quint16 DefaultPort = 12345;
+const quint16 HostPlayer = 1;
+
+enum Opcode : quint8 {
+    Hello = 1,
+    Chat = 2,
+    StrokeBegin = 3,
+    StrokePoint = 4,
+    StrokeEnd = 5,
+    StrokePoints = 6,
+    SnapshotData = 7,
+    SnapshotDone = 8,
+    Undo = 9,
+    Redo = 10,
+    Ping = 11,
+    Pong = 12
+};
+
+struct Frame {
+    quint8 opcode = 0;
+    quint16 origin = 0;
+    quint32 sequence = 0;
+    QByteArray payload;
+};
+
+struct StrokeStart {
+    QPoint point;
+    int brushSize = 0;
+    quint32 color = 0;
+};
+
+QByteArray encodeFrame(quint8 opcode, const QByteArray &payload = QByteArray(), quint16 origin = 0, quint32 sequence = 0);
+void stampFrame(QByteArray *frames, int offset, quint16 origin, quint32 sequence);
+QByteArray encodeHello(quint32 room = 0, quint16 player = 0);
+QByteArray encodeChat(const QString &message);
+QByteArray encodeStrokeBegin(const QPoint &point, int brushSize, quint32 color);
+QByteArray encodeStrokePoint(const QPoint &point);
+QByteArray encodeStrokePoints(const QPoint &origin, const QVector<QPoint> &points);
+QByteArray encodeStrokeEnd();
+QByteArray encodeSnapshot(const QByteArray &image);
+QByteArray encodeUndo();
+QByteArray encodeRedo();
+QByteArray encodePing(qint64 time);
+QByteArray encodePong(qint64 echoedTime, qint64 time);
+
+bool decodeHello(const QByteArray &payload, quint8 *version, quint32 *room, quint16 *player);
+bool decodeChat(const QByteArray &payload, QString *message);
+bool decodeStrokeBegin(const QByteArray &payload, StrokeStart *start);
+bool decodeStrokePoint(const QByteArray &payload, QPoint *point);
+bool decodeStrokePoints(const QByteArray &payload, const QPoint &origin, QVector<QPoint> *points);
+bool decodePing(const QByteArray &payload, qint64 *time);
+bool decodePong(const QByteArray &payload, qint64 *echoedTime, qint64 *time);
+bool isCanvasOpcode(quint8 opcode);
+bool isRelayedOpcode(quint8 opcode);
+
+}
+
+class FrameReader {
+public:
+    void append(const QByteArray &data);
+    bool readFrame(Protocol::Frame *frame);
+    void clear();
+
+private:
+    QByteArray buffer;
+    int offset = 0;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "relayserver.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("drawit-relay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless Draw It relay server hosting many rooms on one port.");
+    parser.addHelpOption();
+    QCommandLineOption portOption({"p", "port"}, "Port to listen on.", "port", QString::number(Protocol::DefaultPort));
+    QCommandLineOption threadsOption({"t", "threads"}, "Number of worker threads rooms are sharded across.", "count", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption playersOption({"m", "max-players"}, "Maximum players per room.", "count", "16");
+    parser.addOption(portOption);
+    parser.addOption(threadsOption);
+    parser.addOption(playersOption);
+    parser.process(a);
+
+    RelayServer server(parser.value(threadsOption).toInt(), parser.value(playersOption).toInt());
+    quint16 port = quint16(parser.value(portOption).toUInt());
+    if (!server.listen(QHostAddress::Any, port)) {
+        qCritical("Could not listen on port %u: %s", port, qPrintable(server.errorString()));
+        return 1;
+    }
+    qInfo("Relay listening on port %u", port);
+    return a.exec();
+}
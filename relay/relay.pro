@@ -0,0 +1,23 @@
+QT       = core network
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = drawit-relay
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    relayserver.cpp \
+    ../metrics.cpp \
+    ../protocol.cpp
+
+HEADERS += \
+    relayserver.h \
+    ../metrics.h \
+    ../protocol.h
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,174 @@
+#include "relayserver.h"
+#include "metrics.h"
+#include <QThread>
+#include <QTimer>
+#include <QMetaObject>
+
+static const int HandshakeTimeoutMs = 5000;
+
+RelayWorker::RelayWorker(int maxPlayersPerRoom, QObject *parent) : QObject(parent), maxPlayersPerRoom(maxPlayersPerRoom), nextPeerId(Protocol::HostPlayer + 1) {
+}
+
+void RelayWorker::addPeer(QTcpSocket *socket, quint32 room, const FrameReader &reader) {
+    if (rooms.value(room).size() >= maxPlayersPerRoom) {
+        qInfo("Room %u is full, rejecting peer", room);
+        socket->abort();
+        socket->deleteLater();
+        return;
+    }
+
+    QVector<QTcpSocket*> &members = rooms[room];
+    socket->setParent(this);
+    Peer peer;
+    peer.room = room;
+    peer.id = allocatePeerId();
+    peer.reader = reader;
+    peers.insert(socket, peer);
+    members.append(socket);
+    connect(socket, &QTcpSocket::readyRead, this, &RelayWorker::readPeerData);
+    connect(socket, &QTcpSocket::disconnected, this, &RelayWorker::peerDisconnected);
+    qInfo("Peer joined room %u (%d players)", room, int(members.size()));
+    socket->write(Protocol::encodeHello(room, peer.id));
+
+    processPeer(socket);
+}
+
+// The counter wraps after 65535 joins, so it skips 0, the host's ID and
+// any ID a connected peer still holds.
+quint16 RelayWorker::allocatePeerId() {
+    forever {
+        quint16 id = nextPeerId++;
+        if (id > Protocol::HostPlayer && !usedIds.contains(id)) {
+            usedIds.insert(id);
+            return id;
+        }
+    }
+}
+
+void RelayWorker::readPeerData() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket && peers.contains(socket)) {
+        processPeer(socket);
+    }
+}
+
+void RelayWorker::processPeer(QTcpSocket *socket) {
+    Peer &peer = peers[socket];
+    peer.reader.append(socket->readAll());
+    Protocol::Frame frame;
+    while (peer.reader.readFrame(&frame)) {
+        if (frame.opcode == Protocol::Hello || frame.opcode == Protocol::Pong) continue;
+        if (frame.opcode == Protocol::Ping) {
+            qint64 time = 0;
+            if (Protocol::decodePing(frame.payload, &time)) {
+                socket->write(Protocol::encodePong(time, ClientMetrics::now()));
+            }
+            continue;
+        }
+        if (Protocol::isRelayedOpcode(frame.opcode)) {
+            quint32 &lastSequence = frame.opcode == Protocol::Chat ? peer.lastChatSequence : peer.lastSequence;
+            if (frame.sequence != 0) {
+                if (frame.sequence <= lastSequence) continue;
+                lastSequence = frame.sequence;
+            }
+            relay(socket, Protocol::encodeFrame(frame.opcode, frame.payload, peer.id, frame.sequence));
+            continue;
+        }
+        relay(socket, Protocol::encodeFrame(frame.opcode, frame.payload));
+    }
+}
+
+void RelayWorker::peerDisconnected() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !peers.contains(socket)) return;
+    relay(socket, Protocol::encodeFrame(Protocol::StrokeEnd, QByteArray(), peers.value(socket).id));
+    const Peer peer = peers.take(socket);
+    usedIds.remove(peer.id);
+    quint32 room = peer.room;
+    QVector<QTcpSocket*> &members = rooms[room];
+    members.removeAll(socket);
+    qInfo("Peer left room %u (%d players)", room, int(members.size()));
+    if (members.isEmpty()) rooms.remove(room);
+    socket->deleteLater();
+}
+
+void RelayWorker::relay(QTcpSocket *origin, const QByteArray &frame) {
+    const QVector<QTcpSocket*> members = rooms.value(peers.value(origin).room);
+    for (QTcpSocket *member : members) {
+        if (member != origin) {
+            member->write(frame);
+        }
+    }
+}
+
+RelayServer::RelayServer(int workerCount, int maxPlayersPerRoom, QObject *parent) : QTcpServer(parent) {
+    for (int i = 0; i < qMax(1, workerCount); ++i) {
+        QThread *thread = new QThread(this);
+        RelayWorker *worker = new RelayWorker(maxPlayersPerRoom);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        workerThreads.append(thread);
+        workers.append(worker);
+    }
+    connect(this, &QTcpServer::newConnection, this, &RelayServer::handleNewConnection);
+}
+
+RelayServer::~RelayServer() {
+    close();
+    for (QThread *thread : workerThreads) {
+        thread->quit();
+        thread->wait();
+    }
+}
+
+void RelayServer::handleNewConnection() {
+    while (hasPendingConnections()) {
+        QTcpSocket *socket = nextPendingConnection();
+        pending.insert(socket, FrameReader());
+        connect(socket, &QTcpSocket::readyRead, this, &RelayServer::readHandshake);
+        connect(socket, &QTcpSocket::disconnected, this, &RelayServer::pendingDisconnected);
+        QTimer::singleShot(HandshakeTimeoutMs, this, [this, socket]() {
+            if (pending.contains(socket)) socket->abort();
+        });
+        socket->write(Protocol::encodeHello());
+    }
+}
+
+void RelayServer::readHandshake() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !pending.contains(socket)) return;
+
+    FrameReader &reader = pending[socket];
+    reader.append(socket->readAll());
+    Protocol::Frame frame;
+    if (!reader.readFrame(&frame)) return;
+
+    quint8 version = 0;
+    quint32 room = 0;
+    quint16 player = 0;
+    if (frame.opcode != Protocol::Hello || !Protocol::decodeHello(frame.payload, &version, &room, &player) || version != Protocol::Version) {
+        socket->abort();
+        return;
+    }
+    handOff(socket, room);
+}
+
+void RelayServer::pendingDisconnected() {
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket) return;
+    pending.remove(socket);
+    socket->deleteLater();
+}
+
+void RelayServer::handOff(QTcpSocket *socket, quint32 room) {
+    FrameReader reader = pending.take(socket);
+    socket->disconnect(this);
+    socket->setParent(nullptr);
+
+    RelayWorker *worker = workers[int(room % quint32(workers.size()))];
+    socket->moveToThread(worker->thread());
+    QMetaObject::invokeMethod(worker, [worker, socket, room, reader]() {
+        worker->addPeer(socket, room, reader);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,70 @@
+#ifndef RELAYSERVER_H
+#define RELAYSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include "protocol.h"
+
+class QThread;
+
+// Owns every room whose ID maps to it and relays frames between the
+// members of each room. All of its sockets live on the worker's thread.
+// Each member gets a player ID that its chat and canvas frames are stamped
+// with on the way through, and frames repeating a sequence number the
+// member already sent are dropped, counting chat and canvas separately.
+class RelayWorker : public QObject {
+    Q_OBJECT
+public:
+    explicit RelayWorker(int maxPlayersPerRoom, QObject *parent = nullptr);
+    void addPeer(QTcpSocket *socket, quint32 room, const FrameReader &reader);
+
+private slots:
+    void readPeerData();
+    void peerDisconnected();
+
+private:
+    struct Peer {
+        quint32 room = 0;
+        quint16 id = 0;
+        quint32 lastSequence = 0;
+        quint32 lastChatSequence = 0;
+        FrameReader reader;
+    };
+
+    quint16 allocatePeerId();
+    void processPeer(QTcpSocket *socket);
+    void relay(QTcpSocket *origin, const QByteArray &frame);
+
+    QHash<QTcpSocket*, Peer> peers;
+    QSet<quint16> usedIds;
+    QHash<quint32, QVector<QTcpSocket*>> rooms;
+    int maxPlayersPerRoom;
+    quint16 nextPeerId;
+};
+
+// Accepts connections on one port, waits for the Hello handshake and then
+// hands the socket to the worker thread that owns the requested room.
+class RelayServer : public QTcpServer {
+    Q_OBJECT
+public:
+    RelayServer(int workerCount, int maxPlayersPerRoom, QObject *parent = nullptr);
+    ~RelayServer();
+
+private slots:
+    void handleNewConnection();
+    void readHandshake();
+    void pendingDisconnected();
+
+private:
+    void handOff(QTcpSocket *socket, quint32 room);
+
+    QVector<QThread*> workerThreads;
+    QVector<RelayWorker*> workers;
+    QHash<QTcpSocket*, FrameReader> pending;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "remoteplayback.h"
+#include <limits>
+
+static const qint64 MaxDelay = 100000;
+static const qint64 MaxLag = 250000;
+static const qint64 MinInterval = 1000;
+// Gaps longer than this are pauses in the drawing, not network timing.
+static const qint64 MaxMeasuredGap = 250000;
+
+qint64 RemotePlayback::push(const NetEvent &event) {
+    Player &player = players[event.peer];
+    const qint64 arrival = event.receivedAt;
+
+    // RFC 3550 style estimates: the interval follows the arrival gaps and
+    // the jitter follows how far each gap strays from the interval.
+    if (event.type == NetEvent::StrokePoints && player.lastArrival >= 0) {
+        qint64 gap = arrival - player.lastArrival;
+        if (gap >= 0 && gap < MaxMeasuredGap) {
+            player.jitter += (qAbs(gap - player.interval) - player.jitter) / 16;
+            player.interval = qMax(MinInterval, player.interval + (gap - player.interval) / 8);
+        }
+    }
+    player.lastArrival = event.type == NetEvent::StrokeEnd ? -1 : arrival;
+
+    qint64 delay = qMin(2 * player.jitter, MaxDelay);
+    qint64 start = qMin(qMax(arrival + delay, player.scheduledEnd), arrival + MaxLag);
+
+    Pending pending;
+    pending.event = event;
+    pending.start = start;
+    qint64 duration = 0;
+    if (event.type == NetEvent::StrokePoints && !event.points.isEmpty()) {
+        duration = player.interval;
+        pending.spacing = duration / event.points.size();
+    }
+    player.scheduledEnd = start + duration;
+    player.queue.enqueue(pending);
+    return start - arrival;
+}
+
+void RemotePlayback::release(qint64 now, QVector<NetEvent> *due) {
+    for (auto it = players.begin(); it != players.end(); ++it) {
+        QQueue<Pending> &queue = it.value().queue;
+        while (!queue.isEmpty()) {
+            Pending &head = queue.head();
+            if (head.start > now) break;
+            const int count = head.event.points.size();
+            int ready = count;
+            if (head.spacing > 0 && now < std::numeric_limits<qint64>::max()) {
+                ready = int(qMin<qint64>(count, (now - head.start) / head.spacing + 1));
+            }
+            if (ready < count) {
+                if (ready > head.released) {
+                    NetEvent part = head.event;
+                    part.points = head.event.points.mid(head.released, ready - head.released);
+                    due->append(part);
+                    head.released = ready;
+                }
+                break;
+            }
+            Pending finished = queue.dequeue();
+            if (finished.released > 0) {
+                finished.event.points.remove(0, finished.released);
+            }
+            due->append(finished.event);
+        }
+    }
+}
+
+void RemotePlayback::flush(QVector<NetEvent> *due) {
+    release(std::numeric_limits<qint64>::max(), due);
+}
+
+void RemotePlayback::forget(int peer) {
+    players.remove(peer);
+}
+
+void RemotePlayback::clear() {
+    players.clear();
+}
+
+bool RemotePlayback::isEmpty() const {
+    for (const Player &player : players) {
+        if (!player.queue.isEmpty()) return false;
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef REMOTEPLAYBACK_H
+#define REMOTEPLAYBACK_H
+
+#include <QHash>
+#include <QQueue>
+#include <QVector>
+#include "networkengine.h"
+
+// Gives every remote player a small jitter buffer for its canvas events and
+// hands them back paced for display. Each batch of samples is spread evenly
+// over the player's usual gap between batches, starting when the previous
+// batch finishes but no sooner than its arrival plus a playout delay of
+// twice the player's measured arrival jitter. A player that falls more than
+// a quarter second behind is caught up instead of letting the delay grow.
+// Stroke begin/end and undo/redo keep their place in the player's queue, so
+// they are applied in the order they were drawn. Times are on the
+// ClientMetrics::now() clock that NetEvent::receivedAt is taken on.
+class RemotePlayback {
+public:
+    // Returns how long the event is held past its arrival.
+    qint64 push(const NetEvent &event);
+    void release(qint64 now, QVector<NetEvent> *due);
+    void flush(QVector<NetEvent> *due);
+    void forget(int peer);
+    void clear();
+    bool isEmpty() const;
+
+private:
+    struct Pending {
+        NetEvent event;
+        qint64 start = 0;
+        qint64 spacing = 0;
+        int released = 0;
+    };
+
+    struct Player {
+        QQueue<Pending> queue;
+        qint64 lastArrival = -1;
+        qint64 interval = 16000;
+        qint64 jitter = 0;
+        qint64 scheduledEnd = 0;
+    };
+
+    QHash<int, Player> players;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "sessionrecording.h"
+#include <QtEndian>
+#include <cstring>
+#include <limits>
+
+bool SessionRecorder::open(const QString &path) {
+    close();
+    file.setFileName(path);
+    indexFile.setFileName(path + ".idx");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || !indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        close();
+        return false;
+    }
+    char header[SessionFormat::FileHeaderSize];
+    std::memcpy(header, SessionFormat::Magic, 8);
+    qToLittleEndian(SessionFormat::Version, header + 8);
+    file.write(header, sizeof(header));
+    clock.start();
+    lastKeyframe = -SessionFormat::KeyframeIntervalMs;
+    keyframePending = false;
+    heldRecords.clear();
+    return true;
+}
+
+void SessionRecorder::close() {
+    if (file.isOpen()) {
+        for (const QByteArray &record : heldRecords) {
+            file.write(record);
+        }
+        heldRecords.clear();
+        keyframePending = false;
+        file.close();
+    }
+    if (indexFile.isOpen()) {
+        indexFile.close();
+    }
+}
+
+bool SessionRecorder::keyframeDue() const {
+    return file.isOpen() && !keyframePending && clock.elapsed() - lastKeyframe >= SessionFormat::KeyframeIntervalMs;
+}
+
+QByteArray SessionRecorder::encodeRecord(quint8 type, qint64 timestamp, const QByteArray &payload) const {
+    char header[SessionFormat::RecordHeaderSize];
+    header[0] = char(type);
+    qToLittleEndian(quint32(payload.size()), header + 1);
+    qToLittleEndian(quint64(timestamp), header + 5);
+    QByteArray record(header, sizeof(header));
+    record.append(payload);
+    return record;
+}
+
+void SessionRecorder::recordFrame(quint16 peer, const QByteArray &frame) {
+    if (!file.isOpen()) return;
+    char owner[2];
+    qToLittleEndian(peer, owner);
+    QByteArray record = encodeRecord(SessionFormat::FrameRecord, clock.elapsed(), QByteArray(owner, 2) + frame);
+    if (keyframePending) {
+        heldRecords.append(record);
+    } else {
+        file.write(record);
+    }
+}
+
+void SessionRecorder::beginKeyframe() {
+    if (!file.isOpen()) return;
+    keyframePending = true;
+    pendingTimestamp = clock.elapsed();
+    lastKeyframe = pendingTimestamp;
+}
+
+void SessionRecorder::finishKeyframe(const QByteArray &keyframe) {
+    if (!file.isOpen() || !keyframePending) return;
+    writeKeyframe(pendingTimestamp, keyframe);
+    for (const QByteArray &record : heldRecords) {
+        file.write(record);
+    }
+    heldRecords.clear();
+    keyframePending = false;
+}
+
+void SessionRecorder::writeKeyframe(qint64 timestamp, const QByteArray &keyframe) {
+    char entry[SessionFormat::IndexEntrySize];
+    qToLittleEndian(quint64(timestamp), entry);
+    qToLittleEndian(quint64(file.pos()), entry + 8);
+    file.write(encodeRecord(SessionFormat::KeyframeRecord, timestamp, keyframe));
+    file.flush();
+    indexFile.write(entry, sizeof(entry));
+    indexFile.flush();
+}
+
+void SessionRecorder::flush() {
+    if (file.isOpen()) {
+        file.flush();
+    }
+}
+
+SessionReader::~SessionReader() {
+    close();
+}
+
+bool SessionReader::open(const QString &path) {
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < SessionFormat::FileHeaderSize) {
+        close();
+        return false;
+    }
+    size = file.size();
+    data = file.map(0, size);
+    if (!data || std::memcmp(data, SessionFormat::Magic, 8) != 0
+        || qFromLittleEndian<quint32>(data + 8) != SessionFormat::Version) {
+        close();
+        return false;
+    }
+
+    indexFile.setFileName(path + ".idx");
+    if (indexFile.open(QIODevice::ReadOnly) && indexFile.size() >= SessionFormat::IndexEntrySize) {
+        indexCount = indexFile.size() / SessionFormat::IndexEntrySize;
+        index = indexFile.map(0, indexCount * SessionFormat::IndexEntrySize);
+        if (!index) indexCount = 0;
+    }
+    return true;
+}
+
+void SessionReader::close() {
+    if (data) file.unmap(const_cast<uchar*>(data));
+    if (index) indexFile.unmap(const_cast<uchar*>(index));
+    data = nullptr;
+    index = nullptr;
+    size = 0;
+    indexCount = 0;
+    file.close();
+    indexFile.close();
+}
+
+qint64 SessionReader::keyframeOffset(qint64 timestamp) const {
+    qint64 low = 0;
+    qint64 high = indexCount;
+    while (low < high) {
+        qint64 middle = (low + high) / 2;
+        if (qint64(qFromLittleEndian<quint64>(index + middle * SessionFormat::IndexEntrySize)) <= timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) return SessionFormat::FileHeaderSize;
+    qint64 offset = qint64(qFromLittleEndian<quint64>(index + (low - 1) * SessionFormat::IndexEntrySize + 8));
+    return offset < size ? offset : SessionFormat::FileHeaderSize;
+}
+
+qint64 SessionReader::duration() const {
+    qint64 offset = indexCount > 0 ? keyframeOffset(std::numeric_limits<qint64>::max()) : SessionFormat::FileHeaderSize;
+    qint64 last = 0;
+    SessionRecord record;
+    while (readRecord(&offset, &record)) {
+        last = record.timestamp;
+    }
+    return last;
+}
+
+bool SessionReader::readRecord(qint64 *offset, SessionRecord *record) const {
+    if (!data || size - *offset < SessionFormat::RecordHeaderSize) return false;
+    const uchar *header = data + *offset;
+    qint64 length = qFromLittleEndian<quint32>(header + 1);
+    if (size - *offset - SessionFormat::RecordHeaderSize < length) return false;
+
+    record->type = header[0];
+    record->timestamp = qint64(qFromLittleEndian<quint64>(header + 5));
+    const char *payload = reinterpret_cast<const char*>(header + SessionFormat::RecordHeaderSize);
+    if (record->type == SessionFormat::FrameRecord) {
+        if (length < 2) return false;
+        record->peer = qFromLittleEndian<quint16>(payload);
+        record->payload = QByteArray::fromRawData(payload + 2, int(length - 2));
+    } else {
+        record->peer = 0;
+        record->payload = QByteArray::fromRawData(payload, int(length));
+    }
+    *offset += SessionFormat::RecordHeaderSize + length;
+    return true;
+}
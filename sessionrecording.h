@@ -0,0 +1,88 @@
+#ifndef SESSIONRECORDING_H
+#define SESSIONRECORDING_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+// A recording is an append-only file of records: a 12-byte file header
+// (magic, version) followed by records of [type u8][length u32]
+// [timestamp ms u64][payload]. Frame records hold the sender's peer ID
+// (0 for the local player) and one protocol frame; keyframe records hold
+// the whole canvas state so playback can start there. Every keyframe's
+// timestamp and file offset is appended to a sidecar "<file>.idx" as two
+// u64 values, which lets a reader seek without decoding from the start.
+// The version follows the frame header layout, so a recording made with an
+// older protocol is refused rather than misread.
+namespace SessionFormat {
+
+const char Magic[8] = {'D', 'R', 'A', 'W', 'R', 'E', 'C', '1'};
+const quint32 Version = 2;
+const int FileHeaderSize = 12;
+const int RecordHeaderSize = 13;
+const int IndexEntrySize = 16;
+const qint64 KeyframeIntervalMs = 30000;
+
+enum RecordType : quint8 {
+    FrameRecord = 1,
+    KeyframeRecord = 2
+};
+
+}
+
+struct SessionRecord {
+    quint8 type = 0;
+    qint64 timestamp = 0;
+    quint16 peer = 0;
+    QByteArray payload;
+};
+
+class SessionRecorder {
+public:
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+    bool keyframeDue() const;
+
+    void recordFrame(quint16 peer, const QByteArray &frame);
+    void beginKeyframe();
+    void finishKeyframe(const QByteArray &keyframe);
+    void flush();
+
+private:
+    QByteArray encodeRecord(quint8 type, qint64 timestamp, const QByteArray &payload) const;
+    void writeKeyframe(qint64 timestamp, const QByteArray &keyframe);
+
+    QFile file;
+    QFile indexFile;
+    QElapsedTimer clock;
+    qint64 lastKeyframe = 0;
+    bool keyframePending = false;
+    qint64 pendingTimestamp = 0;
+    QVector<QByteArray> heldRecords;
+};
+
+// Reads a recording through a memory mapping, so only the pages that are
+// actually visited are loaded. Payloads returned by readRecord() point
+// straight into the mapping and stay valid until close().
+class SessionReader {
+public:
+    ~SessionReader();
+    bool open(const QString &path);
+    void close();
+    qint64 duration() const;
+    qint64 keyframeOffset(qint64 timestamp) const;
+    bool readRecord(qint64 *offset, SessionRecord *record) const;
+
+private:
+    QFile file;
+    QFile indexFile;
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    const uchar *index = nullptr;
+    qint64 indexCount = 0;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "spatialindex.h"
+#include <algorithm>
+#include <limits>
+
+SpatialIndex::SpatialIndex(const QSize &size) : canvasSize(size), nextOrder(0) {
+    columns = (size.width() + CellSize - 1) / CellSize;
+    rows = (size.height() + CellSize - 1) / CellSize;
+    cells.resize(columns * rows);
+}
+
+QRect SpatialIndex::cellRange(const QRect &rect) const {
+    QRect clipped = rect.intersected(QRect(QPoint(0, 0), canvasSize));
+    if (clipped.isEmpty()) return QRect();
+    return QRect(QPoint(clipped.left() / CellSize, clipped.top() / CellSize),
+                 QPoint(clipped.right() / CellSize, clipped.bottom() / CellSize));
+}
+
+void SpatialIndex::insert(const StrokeStore &store, int stroke, int point) {
+    QRect range = cellRange(store.segmentBounds(stroke, point));
+    if (range.isNull()) return;
+    insert(store, stroke, point, nextOrder++);
+}
+
+void SpatialIndex::insert(const StrokeStore &store, int stroke, int point, quint32 order) {
+    QRect range = cellRange(store.segmentBounds(stroke, point));
+    if (range.isNull()) return;
+    Entry entry;
+    entry.order = order;
+    entry.stroke = stroke;
+    entry.point = point;
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            cells[row * columns + column].append(entry);
+        }
+    }
+}
+
+void SpatialIndex::removeStroke(const StrokeStore &store, int stroke, QVector<quint32> *orders) {
+    const Stroke &record = store.stroke(stroke);
+    if (orders) orders->fill(std::numeric_limits<quint32>::max(), int(record.pointCount));
+    int margin = record.brushSize / 2 + 2;
+    QRect range = cellRange(record.bounds().adjusted(-margin, -margin, margin, margin));
+    if (range.isNull()) return;
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            QVector<Entry> &cell = cells[row * columns + column];
+            cell.erase(std::remove_if(cell.begin(), cell.end(), [stroke, orders](const Entry &entry) {
+                if (entry.stroke != stroke) return false;
+                if (orders) (*orders)[entry.point] = entry.order;
+                return true;
+            }), cell.end());
+        }
+    }
+}
+
+void SpatialIndex::discard(const QVector<int> &discarded) {
+    if (discarded.isEmpty()) return;
+    for (QVector<Entry> &cell : cells) {
+        cell.erase(std::remove_if(cell.begin(), cell.end(), [&discarded](const Entry &entry) {
+            return std::binary_search(discarded.begin(), discarded.end(), int(entry.stroke));
+        }), cell.end());
+        for (Entry &entry : cell) {
+            entry.stroke = StrokeStore::renumbered(discarded, entry.stroke);
+        }
+    }
+}
+
+void SpatialIndex::clear() {
+    for (QVector<Entry> &cell : cells) {
+        cell.clear();
+    }
+    nextOrder = 0;
+}
+
+QVector<SpatialIndex::Entry> SpatialIndex::collect(const StrokeStore &store, const QRect &rect) const {
+    QVector<Entry> found;
+    QRect range = cellRange(rect);
+    if (range.isNull()) return found;
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            for (const Entry &entry : cells[row * columns + column]) {
+                if (store.segmentBounds(entry.stroke, entry.point).intersects(rect)) {
+                    found.append(entry);
+                }
+            }
+        }
+    }
+    std::sort(found.begin(), found.end(), [](const Entry &a, const Entry &b) { return a.order < b.order; });
+    found.erase(std::unique(found.begin(), found.end(), [](const Entry &a, const Entry &b) { return a.order == b.order; }), found.end());
+    return found;
+}
+
+QVector<SegmentRef> SpatialIndex::query(const StrokeStore &store, const QRect &rect) const {
+    QVector<SegmentRef> result;
+    const QVector<Entry> found = collect(store, rect);
+    result.reserve(found.size());
+    for (const Entry &entry : found) {
+        result.append(SegmentRef{entry.stroke, entry.point});
+    }
+    return result;
+}
+
+QVector<SegmentRef> SpatialIndex::queryRadius(const StrokeStore &store, const QPoint &center, int radius) const {
+    QVector<SegmentRef> result;
+    const QVector<Entry> found = collect(store, QRect(center, center).adjusted(-radius, -radius, radius, radius));
+    for (const Entry &entry : found) {
+        QPoint to = store.point(entry.stroke, entry.point);
+        QPoint from = entry.point > 0 ? store.point(entry.stroke, entry.point - 1) : to;
+        double reach = radius + store.stroke(entry.stroke).brushSize / 2.0;
+        double dx = to.x() - from.x();
+        double dy = to.y() - from.y();
+        double lengthSquared = dx * dx + dy * dy;
+        double t = 0;
+        if (lengthSquared > 0) {
+            t = qBound(0.0, ((center.x() - from.x()) * dx + (center.y() - from.y()) * dy) / lengthSquared, 1.0);
+        }
+        double px = from.x() + t * dx - center.x();
+        double py = from.y() + t * dy - center.y();
+        if (px * px + py * py <= reach * reach) {
+            result.append(SegmentRef{entry.stroke, entry.point});
+        }
+    }
+    return result;
+}
+
+QVector<int> SpatialIndex::strokesIn(const StrokeStore &store, const QRect &rect) const {
+    QVector<int> strokes;
+    for (const Entry &entry : collect(store, rect)) {
+        strokes.append(entry.stroke);
+    }
+    std::sort(strokes.begin(), strokes.end());
+    strokes.erase(std::unique(strokes.begin(), strokes.end()), strokes.end());
+    return strokes;
+}
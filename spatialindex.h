@@ -0,0 +1,56 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QRect>
+#include <QSize>
+#include <QVector>
+#include "strokestore.h"
+
+struct SegmentRef {
+    qint32 stroke;
+    qint32 point;
+};
+
+// Uniform grid over the bounding boxes of stroke segments. Segment point
+// is the index of the segment's end point within its stroke; point 0 is
+// the dot a stroke starts with. Queries return segments in the order they
+// were inserted, which is the order they have to be painted in. When a
+// stroke is rewritten in place (simplified), its segments can be
+// re-inserted under the orders they were removed with, so it keeps its
+// place. Strokes flattened into a layer's base leave the index, which then
+// only holds what tile rebuilds still draw. discard() follows
+// StrokeStore::discard(), keeping every other segment's order.
+class SpatialIndex {
+public:
+    static const int CellSize = 32;
+
+    explicit SpatialIndex(const QSize &size = QSize());
+
+    void insert(const StrokeStore &store, int stroke, int point);
+    void insert(const StrokeStore &store, int stroke, int point, quint32 order);
+    void removeStroke(const StrokeStore &store, int stroke, QVector<quint32> *orders = nullptr);
+    void discard(const QVector<int> &discarded);
+    void clear();
+
+    QVector<SegmentRef> query(const StrokeStore &store, const QRect &rect) const;
+    QVector<SegmentRef> queryRadius(const StrokeStore &store, const QPoint &center, int radius) const;
+    QVector<int> strokesIn(const StrokeStore &store, const QRect &rect) const;
+
+private:
+    struct Entry {
+        quint32 order;
+        qint32 stroke;
+        qint32 point;
+    };
+
+    QRect cellRange(const QRect &rect) const;
+    QVector<Entry> collect(const StrokeStore &store, const QRect &rect) const;
+
+    QSize canvasSize;
+    int columns;
+    int rows;
+    quint32 nextOrder;
+    QVector<QVector<Entry>> cells;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. push() leaves the item untouched when the queue is full so the
+// caller can keep it in a local backlog and retry.
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() : items(new T[Capacity]), head(0), tail(0) {}
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    bool push(T &&item) {
+        std::size_t current = tail.load(std::memory_order_relaxed);
+        if (current - head.load(std::memory_order_acquire) == Capacity) return false;
+        items[current & (Capacity - 1)] = std::move(item);
+        tail.store(current + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::size_t current = head.load(std::memory_order_relaxed);
+        if (current == tail.load(std::memory_order_acquire)) return false;
+        item = std::move(items[current & (Capacity - 1)]);
+        head.store(current + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::unique_ptr<T[]> items;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+};
+
+#endif
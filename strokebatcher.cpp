@@ -0,0 +1,77 @@
+#include "strokebatcher.h"
+#include "protocol.h"
+#include "polyline.h"
+
+static const int MaxPendingPoints = 4096;
+static const int RateWindowMs = 1000;
+
+StrokeBatcher::StrokeBatcher(QObject *parent) : QObject(parent), active(false), simplifyTolerance(0), windowBytes(0), rate(0) {
+    timer.setInterval(16);
+    connect(&timer, &QTimer::timeout, this, &StrokeBatcher::flush);
+    window.start();
+}
+
+void StrokeBatcher::setInterval(int msec) {
+    flush();
+    timer.setInterval(qMax(0, msec));
+}
+
+double StrokeBatcher::bytesPerSecond() const {
+    qint64 elapsed = window.elapsed();
+    if (elapsed < RateWindowMs) return rate;
+    return double(windowBytes) * 1000.0 / double(elapsed);
+}
+
+void StrokeBatcher::beginStroke(const QPoint &point, int brushSize, quint32 color) {
+    endStroke();
+    active = true;
+    lastSent = point;
+    send(Protocol::encodeStrokeBegin(point, brushSize, color));
+}
+
+void StrokeBatcher::addPoint(const QPoint &point) {
+    if (!active) return;
+    pending.append(point);
+    if (timer.interval() == 0 || pending.size() >= MaxPendingPoints) {
+        flush();
+    } else if (!timer.isActive()) {
+        timer.start();
+    }
+}
+
+void StrokeBatcher::endStroke() {
+    if (!active) return;
+    flush();
+    active = false;
+    send(Protocol::encodeStrokeEnd());
+}
+
+void StrokeBatcher::flush() {
+    timer.stop();
+    if (pending.isEmpty()) return;
+    if (simplifyTolerance > 0 && pending.size() > 1) {
+        QVector<QPoint> run;
+        run.reserve(pending.size() + 1);
+        run.append(lastSent);
+        run += pending;
+        const QVector<int> kept = Polyline::simplify(run.constData(), run.size(), simplifyTolerance);
+        pending.clear();
+        for (int i = 1; i < kept.size(); ++i) {
+            pending.append(run[kept[i]]);
+        }
+    }
+    send(Protocol::encodeStrokePoints(lastSent, pending));
+    lastSent = pending.last();
+    pending.clear();
+}
+
+void StrokeBatcher::send(const QByteArray &frame) {
+    qint64 elapsed = window.elapsed();
+    if (elapsed >= RateWindowMs) {
+        rate = double(windowBytes) * 1000.0 / double(elapsed);
+        windowBytes = 0;
+        window.restart();
+    }
+    windowBytes += frame.size();
+    emit frameReady(frame);
+}
@@ -0,0 +1,46 @@
+#ifndef STROKEBATCHER_H
+#define STROKEBATCHER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QPoint>
+#include <QByteArray>
+
+// Collects local stroke samples and emits them as one StrokePoints frame
+// per interval. Begin/end frames flush whatever is pending first so the
+// ordering on the wire matches the order the samples were drawn in. With a
+// simplify tolerance set, each batch is thinned with Ramer-Douglas-Peucker
+// before it goes out.
+class StrokeBatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit StrokeBatcher(QObject *parent = nullptr);
+    void setInterval(int msec);
+    int interval() const { return timer.interval(); }
+    void setSimplifyTolerance(double tolerance) { simplifyTolerance = tolerance; }
+    double bytesPerSecond() const;
+
+    void beginStroke(const QPoint &point, int brushSize, quint32 color);
+    void addPoint(const QPoint &point);
+    void endStroke();
+    void flush();
+
+signals:
+    void frameReady(const QByteArray &frame);
+
+private:
+    void send(const QByteArray &frame);
+
+    QTimer timer;
+    QVector<QPoint> pending;
+    QPoint lastSent;
+    bool active;
+    double simplifyTolerance;
+    qint64 windowBytes;
+    QElapsedTimer window;
+    double rate;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "strokestore.h"
+#include "polyline.h"
+#include <algorithm>
+
+StrokePoint StrokeStore::pack(const QPoint &point) {
+    StrokePoint packed;
+    packed.x = qint16(qBound(-32768, point.x(), 32767));
+    packed.y = qint16(qBound(-32768, point.y(), 32767));
+    return packed;
+}
+
+int StrokeStore::beginStroke(const QPoint &point, int brushSize, const QColor &color, quint16 owner) {
+    StrokePoint packed = pack(point);
+    Stroke stroke;
+    stroke.firstPoint = quint32(points.size());
+    stroke.pointCount = 1;
+    stroke.color = color.rgba();
+    stroke.brushSize = quint8(qBound(1, brushSize, 255));
+    stroke.finished = false;
+    stroke.undone = false;
+    stroke.hidden = false;
+    stroke.baked = false;
+    stroke.owner = owner;
+    stroke.left = stroke.right = packed.x;
+    stroke.top = stroke.bottom = packed.y;
+    points.append(packed);
+    strokes.append(stroke);
+    return strokes.size() - 1;
+}
+
+void StrokeStore::appendPoint(int index, const QPoint &point) {
+    Stroke &stroke = strokes[index];
+    if (stroke.finished) return;
+
+    if (stroke.firstPoint + stroke.pointCount != quint32(points.size())) {
+        int oldSize = points.size();
+        points.resize(oldSize + int(stroke.pointCount));
+        std::copy(points.constData() + stroke.firstPoint,
+                  points.constData() + stroke.firstPoint + stroke.pointCount,
+                  points.data() + oldSize);
+        wastedPoints += int(stroke.pointCount);
+        stroke.firstPoint = quint32(oldSize);
+    }
+
+    StrokePoint packed = pack(point);
+    points.append(packed);
+    ++stroke.pointCount;
+    stroke.left = qMin(stroke.left, packed.x);
+    stroke.right = qMax(stroke.right, packed.x);
+    stroke.top = qMin(stroke.top, packed.y);
+    stroke.bottom = qMax(stroke.bottom, packed.y);
+}
+
+void StrokeStore::endStroke(int index) {
+    strokes[index].finished = true;
+    if (wastedPoints > points.size() / 2) {
+        compact();
+    }
+}
+
+QVector<int> StrokeStore::simplify(int index, double tolerance) {
+    Stroke &stroke = strokes[index];
+    QVector<QPoint> original;
+    original.reserve(int(stroke.pointCount));
+    for (quint32 i = 0; i < stroke.pointCount; ++i) {
+        original.append(points[int(stroke.firstPoint + i)].toPoint());
+    }
+    QVector<int> kept = Polyline::simplify(original.constData(), original.size(), tolerance);
+    if (kept.size() == original.size()) return kept;
+
+    StrokePoint *first = points.data() + stroke.firstPoint;
+    stroke.left = stroke.right = first[0].x;
+    stroke.top = stroke.bottom = first[0].y;
+    for (int i = 0; i < kept.size(); ++i) {
+        first[i] = first[kept[i]];
+        stroke.left = qMin(stroke.left, first[i].x);
+        stroke.right = qMax(stroke.right, first[i].x);
+        stroke.top = qMin(stroke.top, first[i].y);
+        stroke.bottom = qMax(stroke.bottom, first[i].y);
+    }
+
+    int removed = int(stroke.pointCount) - kept.size();
+    if (stroke.firstPoint + stroke.pointCount == quint32(points.size())) {
+        points.resize(points.size() - removed);
+    } else {
+        wastedPoints += removed;
+    }
+    stroke.pointCount = quint32(kept.size());
+    return kept;
+}
+
+void StrokeStore::setUndone(int index, bool undone) {
+    strokes[index].undone = undone;
+}
+
+void StrokeStore::setHidden(int index, bool hidden) {
+    strokes[index].hidden = hidden;
+}
+
+void StrokeStore::setBaked(int index, bool baked) {
+    strokes[index].baked = baked;
+}
+
+void StrokeStore::clear() {
+    strokes.clear();
+    points.clear();
+    wastedPoints = 0;
+}
+
+void StrokeStore::compact() {
+    if (wastedPoints == 0) return;
+    QVector<StrokePoint> packed;
+    packed.reserve(points.size() - wastedPoints);
+    for (Stroke &stroke : strokes) {
+        quint32 first = quint32(packed.size());
+        for (quint32 i = 0; i < stroke.pointCount; ++i) {
+            packed.append(points[int(stroke.firstPoint + i)]);
+        }
+        stroke.firstPoint = first;
+    }
+    points = packed;
+    wastedPoints = 0;
+}
+
+// discarded lists stroke indices in ascending order.
+void StrokeStore::discard(const QVector<int> &discarded) {
+    if (discarded.isEmpty()) return;
+    QVector<Stroke> kept;
+    kept.reserve(strokes.size() - discarded.size());
+    QVector<StrokePoint> packed;
+    packed.reserve(pointCount());
+    int next = 0;
+    for (int i = 0; i < strokes.size(); ++i) {
+        if (next < discarded.size() && discarded[next] == i) {
+            ++next;
+            continue;
+        }
+        Stroke stroke = strokes[i];
+        quint32 first = quint32(packed.size());
+        for (quint32 j = 0; j < stroke.pointCount; ++j) {
+            packed.append(points[int(stroke.firstPoint + j)]);
+        }
+        stroke.firstPoint = first;
+        kept.append(stroke);
+    }
+    strokes = kept;
+    points = packed;
+    wastedPoints = 0;
+}
+
+int StrokeStore::renumbered(const QVector<int> &discarded, int stroke) {
+    return stroke - int(std::lower_bound(discarded.begin(), discarded.end(), stroke) - discarded.begin());
+}
+
+QRect StrokeStore::segmentBounds(int stroke, int point) const {
+    QPoint to = this->point(stroke, point);
+    QPoint from = point > 0 ? this->point(stroke, point - 1) : to;
+    int margin = strokes[stroke].brushSize / 2 + 2;
+    return QRect(from, to).normalized().adjusted(-margin, -margin, margin, margin);
+}
+
+qint64 StrokeStore::memoryUsage() const {
+    return qint64(strokes.capacity()) * qint64(sizeof(Stroke))
+         + qint64(points.capacity()) * qint64(sizeof(StrokePoint));
+}
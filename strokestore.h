@@ -0,0 +1,70 @@
+#ifndef STROKESTORE_H
+#define STROKESTORE_H
+
+#include <QVector>
+#include <QPoint>
+#include <QRect>
+#include <QColor>
+
+struct StrokePoint {
+    qint16 x;
+    qint16 y;
+
+    QPoint toPoint() const { return QPoint(x, y); }
+};
+
+struct Stroke {
+    quint32 firstPoint;
+    quint32 pointCount;
+    QRgb color;
+    quint8 brushSize;
+    bool finished;
+    bool undone;
+    bool hidden;
+    bool baked;
+    quint16 owner;
+    qint16 left;
+    qint16 top;
+    qint16 right;
+    qint16 bottom;
+
+    QRect bounds() const { return QRect(QPoint(left, top), QPoint(right, bottom)); }
+};
+
+// Strokes keep their brush once and index into a single packed point buffer.
+// A stroke's points are always contiguous: extending a stroke that is not the
+// last one written moves it to the end of the buffer, and the gap it leaves is
+// reclaimed by compact(). discard() drops strokes outright once they have
+// been flattened elsewhere; the rest keep their order and are renumbered,
+// and renumbered() tells where a kept stroke ended up.
+class StrokeStore {
+public:
+    int beginStroke(const QPoint &point, int brushSize, const QColor &color, quint16 owner = 0);
+    void appendPoint(int stroke, const QPoint &point);
+    void endStroke(int stroke);
+    QVector<int> simplify(int stroke, double tolerance);
+    void setUndone(int stroke, bool undone);
+    void setHidden(int stroke, bool hidden);
+    void setBaked(int stroke, bool baked);
+    void clear();
+    void compact();
+    void discard(const QVector<int> &discarded);
+    static int renumbered(const QVector<int> &discarded, int stroke);
+
+    int strokeCount() const { return strokes.size(); }
+    int pointCount() const { return points.size() - wastedPoints; }
+    const Stroke &stroke(int index) const { return strokes[index]; }
+    const StrokePoint *strokePoints(int index) const { return points.constData() + strokes[index].firstPoint; }
+    QPoint point(int stroke, int index) const { return strokePoints(stroke)[index].toPoint(); }
+    QRect segmentBounds(int stroke, int point) const;
+    qint64 memoryUsage() const;
+
+private:
+    static StrokePoint pack(const QPoint &point);
+
+    QVector<Stroke> strokes;
+    QVector<StrokePoint> points;
+    int wastedPoints = 0;
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "tiledcanvas.h"
+#include <QPainter>
+#include <QSet>
+#include <QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include "lineraster.h"
+
+TiledCanvas::TiledCanvas(const QSize &size) : canvasSize(size), columns(0), rows(0), rasterizedSegments(0) {
+    columns = (size.width() + TileSize - 1) / TileSize;
+    rows = (size.height() + TileSize - 1) / TileSize;
+    tiles.resize(columns * rows);
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            Tile &tile = tiles[row * columns + column];
+            tile.rect = QRect(column * TileSize, row * TileSize, TileSize, TileSize).intersected(QRect(QPoint(0, 0), size));
+            tile.image = QImage(tile.rect.size(), QImage::Format_ARGB32_Premultiplied);
+            tile.image.fill(Qt::transparent);
+            tile.stale = false;
+        }
+    }
+    base = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    base.fill(Qt::transparent);
+}
+
+void TiledCanvas::setBase(const QImage &image) {
+    base = image;
+    for (Tile &tile : tiles) {
+        tile.stale = true;
+    }
+}
+
+QImage TiledCanvas::layerBase(quint16 owner) const {
+    const Layer *layer = findLayer(owner);
+    return layer ? layer->base : QImage();
+}
+
+void TiledCanvas::setLayerBase(quint16 owner, const QImage &image) {
+    layerFor(owner).base = image;
+}
+
+bool TiledCanvas::isLayerCleared(quint16 owner) const {
+    const Layer *layer = findLayer(owner);
+    return layer && layer->cleared;
+}
+
+QImage TiledCanvas::clearedLayerBase(quint16 owner) const {
+    const Layer *layer = findLayer(owner);
+    return layer ? layer->clearedBase : QImage();
+}
+
+void TiledCanvas::setClearedLayerBase(quint16 owner, const QImage &image) {
+    Layer *layer = findLayer(owner);
+    if (layer && layer->cleared) layer->clearedBase = image;
+}
+
+QVector<quint16> TiledCanvas::layerOwners() const {
+    QVector<quint16> owners;
+    for (const Layer &layer : layers) {
+        owners.append(layer.owner);
+    }
+    return owners;
+}
+
+void TiledCanvas::setLayerVisible(quint16 owner, bool visible) {
+    Layer &layer = layerFor(owner);
+    if (layer.visible == visible) return;
+    layer.visible = visible;
+    markStale(layer);
+}
+
+bool TiledCanvas::isLayerVisible(quint16 owner) const {
+    const Layer *layer = findLayer(owner);
+    return !layer || layer->visible;
+}
+
+// Stops drawing the layer's base and rebuilds its tiles from whatever
+// strokes the index still holds for the owner, typically only one still
+// being drawn.
+void TiledCanvas::clearLayer(quint16 owner) {
+    Layer *layer = findLayer(owner);
+    if (!layer) return;
+    layer->cleared = true;
+    layer->clearedBase = QImage();
+    for (LayerTile &layerTile : layer->tiles) {
+        if (!layerTile.image.isNull()) layerTile.dirty = true;
+    }
+}
+
+// Layers are emptied rather than dropped, so a hidden player stays hidden
+// across a resync. A cleared one comes back, since the snapshot has its
+// strokes flattened in.
+void TiledCanvas::clear() {
+    base = QImage(canvasSize, QImage::Format_ARGB32_Premultiplied);
+    base.fill(Qt::transparent);
+    for (Layer &layer : layers) {
+        layer.cleared = false;
+        layer.base = QImage();
+        layer.clearedBase = QImage();
+        layer.tiles.fill(LayerTile());
+    }
+    paths.clear();
+    for (Tile &tile : tiles) {
+        tile.image.fill(Qt::transparent);
+        tile.stale = false;
+    }
+}
+
+TiledCanvas::Layer *TiledCanvas::findLayer(quint16 owner) {
+    for (Layer &layer : layers) {
+        if (layer.owner == owner) return &layer;
+    }
+    return nullptr;
+}
+
+const TiledCanvas::Layer *TiledCanvas::findLayer(quint16 owner) const {
+    for (const Layer &layer : layers) {
+        if (layer.owner == owner) return &layer;
+    }
+    return nullptr;
+}
+
+// Layers stack in the order their owners first drew.
+TiledCanvas::Layer &TiledCanvas::layerFor(quint16 owner) {
+    if (Layer *layer = findLayer(owner)) return *layer;
+    Layer layer;
+    layer.owner = owner;
+    layer.tiles.resize(tiles.size());
+    layers.append(layer);
+    return layers.last();
+}
+
+QImage &TiledCanvas::layerImage(Layer &layer, int tile) {
+    QImage &image = layer.tiles[tile].image;
+    if (image.isNull()) {
+        const QRect &rect = tiles[tile].rect;
+        image = QImage(rect.size(), QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        if (!layer.base.isNull()) {
+            QPainter painter(&image);
+            painter.drawImage(QPoint(0, 0), layer.base, rect);
+        }
+    }
+    return image;
+}
+
+void TiledCanvas::markStale(const Layer &layer) {
+    for (int i = 0; i < tiles.size(); ++i) {
+        if (!layer.tiles[i].image.isNull()) tiles[i].stale = true;
+    }
+}
+
+void TiledCanvas::cacheStrokePath(const StrokeStore &store, int stroke) {
+    if (paths.size() <= stroke) {
+        paths.resize(stroke + 1);
+    }
+    StrokePath &entry = paths[stroke];
+    entry.cached = true;
+    if (LineRaster::isEnabled()) return;
+
+    const Stroke &record = store.stroke(stroke);
+    const StrokePoint *points = store.strokePoints(stroke);
+    QPainterPath path(points[0].toPoint());
+    path.reserve(int(record.pointCount));
+    for (quint32 i = 1; i < record.pointCount; ++i) {
+        path.lineTo(points[i].toPoint());
+    }
+    if (record.pointCount == 1) {
+        path.lineTo(points[0].toPoint());
+    }
+    entry.path = path;
+}
+
+// Follows StrokeStore::discard().
+void TiledCanvas::discardStrokes(const QVector<int> &discarded) {
+    int kept = 0;
+    int next = 0;
+    for (int i = 0; i < paths.size(); ++i) {
+        if (next < discarded.size() && discarded[next] == i) {
+            ++next;
+            continue;
+        }
+        paths[kept++] = paths[i];
+    }
+    paths.resize(kept);
+}
+
+void TiledCanvas::paintSegment(QPainter *painter, const StrokeStore &store, int stroke, int point) {
+    const Stroke &record = store.stroke(stroke);
+    QPoint to = store.point(stroke, point);
+    QPoint from = point > 0 ? store.point(stroke, point - 1) : to;
+    painter->setPen(QPen(QColor::fromRgba(record.color), record.brushSize, Qt::SolidLine, Qt::RoundCap));
+    painter->drawLine(from, to);
+}
+
+QRect TiledCanvas::tileRange(const QRect &rect) const {
+    QRect clipped = rect.intersected(QRect(QPoint(0, 0), canvasSize));
+    if (clipped.isEmpty()) return QRect();
+    return QRect(QPoint(clipped.left() / TileSize, clipped.top() / TileSize),
+                 QPoint(clipped.right() / TileSize, clipped.bottom() / TileSize));
+}
+
+QRect TiledCanvas::drawSegment(const StrokeStore &store, int stroke, int point) {
+    QRect bounds = store.segmentBounds(stroke, point);
+    QRect range = tileRange(bounds);
+    if (range.isNull()) return bounds;
+
+    const Stroke &record = store.stroke(stroke);
+    Layer &layer = layerFor(record.owner);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            const int index = row * columns + column;
+            if (layer.tiles[index].dirty) continue;
+            QImage &image = layerImage(layer, index);
+            const QRect &rect = tiles[index].rect;
+            if (layer.visible) tiles[index].stale = true;
+            ++rasterizedSegments;
+            if (LineRaster::isEnabled()) {
+                QPoint to = store.point(stroke, point);
+                QPoint from = point > 0 ? store.point(stroke, point - 1) : to;
+                LineRaster::drawSegment(&image, rect.topLeft(), from, to, record.brushSize, record.color);
+                continue;
+            }
+            QPainter painter(&image);
+            painter.setRenderHint(QPainter::Antialiasing);
+            painter.translate(-rect.topLeft());
+            paintSegment(&painter, store, stroke, point);
+        }
+    }
+    return bounds;
+}
+
+void TiledCanvas::invalidate(const QRect &rect, quint16 owner) {
+    QRect range = tileRange(rect);
+    if (range.isNull()) return;
+    Layer &layer = layerFor(owner);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            layer.tiles[row * columns + column].dirty = true;
+        }
+    }
+}
+
+bool TiledCanvas::hasDirtyTiles() const {
+    for (const Tile &tile : tiles) {
+        if (tile.stale) return true;
+    }
+    for (const Layer &layer : layers) {
+        for (const LayerTile &layerTile : layer.tiles) {
+            if (layerTile.dirty) return true;
+        }
+    }
+    return false;
+}
+
+void TiledCanvas::render(const StrokeStore &store, const SpatialIndex &index) {
+    struct Job {
+        const Layer *layer;
+        LayerTile *layerTile;
+        QRect rect;
+    };
+    QVector<Job> dirty;
+    for (Layer &layer : layers) {
+        for (int i = 0; i < layer.tiles.size(); ++i) {
+            LayerTile &layerTile = layer.tiles[i];
+            if (!layerTile.dirty) continue;
+            dirty.append(Job{&layer, &layerTile, tiles[i].rect});
+            if (layer.visible) tiles[i].stale = true;
+        }
+    }
+    if (!dirty.isEmpty()) {
+        std::atomic<int> segments(0);
+        QtConcurrent::blockingMap(dirty, [this, &store, &index, &segments](const Job &job) {
+            segments.fetch_add(renderLayerTile(*job.layer, *job.layerTile, job.rect, store, index), std::memory_order_relaxed);
+        });
+        rasterizedSegments += segments.load();
+    }
+    for (int i = 0; i < tiles.size(); ++i) {
+        if (tiles[i].stale) compose(tiles[i], i);
+    }
+}
+
+// A tile left with nothing on it is freed, so a cleared or undone layer
+// stops costing memory and compositing time there.
+int TiledCanvas::renderLayerTile(const Layer &layer, LayerTile &layerTile, const QRect &rect, const StrokeStore &store, const SpatialIndex &index) const {
+    layerTile.dirty = false;
+    QVector<SegmentRef> segments = index.query(store, rect);
+    segments.erase(std::remove_if(segments.begin(), segments.end(), [&store, &layer](const SegmentRef &ref) {
+        return store.stroke(ref.stroke).owner != layer.owner;
+    }), segments.end());
+    const QImage &layerBase = layer.shownBase();
+    if (segments.isEmpty() && layerBase.isNull()) {
+        layerTile.image = QImage();
+        return 0;
+    }
+
+    QImage &image = layerTile.image;
+    if (image.isNull()) {
+        image = QImage(rect.size(), QImage::Format_ARGB32_Premultiplied);
+    }
+    image.fill(Qt::transparent);
+    const bool fast = LineRaster::isEnabled();
+    QPainter painter(&image);
+    if (!layerBase.isNull()) {
+        painter.drawImage(QPoint(0, 0), layerBase, rect);
+    }
+    if (fast) {
+        painter.end();
+    } else {
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.translate(-rect.topLeft());
+    }
+    QSet<int> pathsDrawn;
+    for (const SegmentRef &ref : segments) {
+        const Stroke &record = store.stroke(ref.stroke);
+        if (ref.stroke < paths.size() && paths[ref.stroke].cached) {
+            if (pathsDrawn.contains(ref.stroke)) continue;
+            pathsDrawn.insert(ref.stroke);
+            if (fast) {
+                LineRaster::drawPolyline(&image, rect.topLeft(), store.strokePoints(ref.stroke), int(record.pointCount), record.brushSize, record.color);
+            } else {
+                painter.strokePath(paths[ref.stroke].path, QPen(QColor::fromRgba(record.color), record.brushSize, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+            }
+            continue;
+        }
+        if (fast) {
+            QPoint to = store.point(ref.stroke, ref.point);
+            QPoint from = ref.point > 0 ? store.point(ref.stroke, ref.point - 1) : to;
+            LineRaster::drawSegment(&image, rect.topLeft(), from, to, record.brushSize, record.color);
+        } else {
+            paintSegment(&painter, store, ref.stroke, ref.point);
+        }
+    }
+    return segments.size();
+}
+
+void TiledCanvas::compose(Tile &tile, int index) const {
+    tile.image.fill(Qt::transparent);
+    QPainter painter(&tile.image);
+    painter.drawImage(QPoint(0, 0), base, tile.rect);
+    for (const Layer &layer : layers) {
+        const QImage &image = layer.tiles[index].image;
+        if (layer.visible && !image.isNull()) {
+            painter.drawImage(QPoint(0, 0), image);
+        }
+    }
+    tile.stale = false;
+}
+
+int TiledCanvas::takeRasterizedSegments() {
+    int segments = rasterizedSegments;
+    rasterizedSegments = 0;
+    return segments;
+}
+
+void TiledCanvas::paint(QPainter *painter, const QRect &exposed) const {
+    QRect range = tileRange(exposed);
+    if (range.isNull()) return;
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            const Tile &tile = tiles[row * columns + column];
+            painter->drawImage(tile.rect.topLeft(), tile.image);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef TILEDCANVAS_H
+#define TILEDCANVAS_H
+
+#include <QImage>
+#include <QPainterPath>
+#include <QRect>
+#include <QVector>
+#include "strokestore.h"
+#include "spatialindex.h"
+
+class QPainter;
+
+// The canvas raster split into fixed-size tiles. Every player (stroke
+// owner) draws into a transparent layer of their own, whose tiles are only
+// allocated where that player has drawn; the visible tiles are composited
+// from the shared base image and the visible layers, and only tiles whose
+// layers changed are composited again. New segments are drawn straight
+// into the owner's layer tile. A layer tile marked dirty is rebuilt from
+// the layer's base plus that owner's segments the spatial index reports
+// inside it, and dirty tiles are rebuilt in parallel on the global thread
+// pool, so undoing, hiding or clearing one player's work never touches
+// the pixels of anyone else's. setBase() swaps the shared base (a received
+// snapshot); setLayerBase() swaps a layer's base for one that already has
+// more of its strokes flattened in, so nothing has to be redrawn. Clearing
+// is local: a cleared layer keeps its base for snapshots and draws from a
+// separate one that only gets what is flattened after the clear.
+// Finished strokes can be marked as cached; a tile rebuild then draws such a
+// stroke once as a whole polyline instead of segment by segment. Segments
+// and polylines are stamped by LineRaster's SIMD kernels, or by QPainter
+// (using a cached QPainterPath for whole strokes) when the rasterizer is
+// switched off.
+class TiledCanvas {
+public:
+    static const int TileSize = 128;
+
+    explicit TiledCanvas(const QSize &size = QSize());
+
+    QSize size() const { return canvasSize; }
+    const QImage &baseImage() const { return base; }
+    void setBase(const QImage &image);
+    QImage layerBase(quint16 owner) const;
+    void setLayerBase(quint16 owner, const QImage &image);
+    bool isLayerCleared(quint16 owner) const;
+    QImage clearedLayerBase(quint16 owner) const;
+    void setClearedLayerBase(quint16 owner, const QImage &image);
+    QVector<quint16> layerOwners() const;
+    void setLayerVisible(quint16 owner, bool visible);
+    bool isLayerVisible(quint16 owner) const;
+    void clearLayer(quint16 owner);
+    void clear();
+
+    QRect drawSegment(const StrokeStore &store, int stroke, int point);
+    void cacheStrokePath(const StrokeStore &store, int stroke);
+    void discardStrokes(const QVector<int> &discarded);
+    void invalidate(const QRect &rect, quint16 owner);
+    bool hasDirtyTiles() const;
+    void render(const StrokeStore &store, const SpatialIndex &index);
+    void paint(QPainter *painter, const QRect &exposed) const;
+    int takeRasterizedSegments();
+
+    static void paintSegment(QPainter *painter, const StrokeStore &store, int stroke, int point);
+
+private:
+    struct Tile {
+        QRect rect;
+        QImage image;
+        bool stale = false;
+    };
+
+    struct LayerTile {
+        QImage image;
+        bool dirty = false;
+    };
+
+    struct Layer {
+        quint16 owner = 0;
+        bool visible = true;
+        bool cleared = false;
+        QImage base;
+        QImage clearedBase;
+        QVector<LayerTile> tiles;
+
+        const QImage &shownBase() const { return cleared ? clearedBase : base; }
+    };
+
+    struct StrokePath {
+        QPainterPath path;
+        bool cached = false;
+    };
+
+    QRect tileRange(const QRect &rect) const;
+    Layer *findLayer(quint16 owner);
+    const Layer *findLayer(quint16 owner) const;
+    Layer &layerFor(quint16 owner);
+    QImage &layerImage(Layer &layer, int tile);
+    void markStale(const Layer &layer);
+    int renderLayerTile(const Layer &layer, LayerTile &layerTile, const QRect &rect, const StrokeStore &store, const SpatialIndex &index) const;
+    void compose(Tile &tile, int index) const;
+
+    QSize canvasSize;
+    int columns;
+    int rows;
+    QImage base;
+    QVector<Tile> tiles;
+    QVector<Layer> layers;
+    QVector<StrokePath> paths;
+    int rasterizedSegments;
+};
+
+#endif